@@ -0,0 +1,211 @@
+#ifndef MINIRAY_ADAPTIVE_HPP
+#define MINIRAY_ADAPTIVE_HPP
+
+/*
+ * Adaptive supersampling. Every pixel first gets the usual ray through its
+ * centre. Pixels whose displayed luminance differs from one of their eight
+ * neighbours by more than the contrast threshold, which is where edges and
+ * shadow boundaries alias, then take extra jittered samples in rounds.
+ * After each round a pixel keeps refining only while the standard error of
+ * its samples is above the variance threshold, up to max_samples. Flat
+ * regions are traced exactly once.
+ */
+#include "camera.hpp"
+#include "image.hpp"
+#include "scene.hpp"
+#include "tile_renderer.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mini_ray {
+
+struct AdaptiveOptions {
+    int max_samples{16};       // Per pixel, including the centre sample
+    int samples_per_round{4};  // Extra samples between variance checks
+    double contrast_threshold{0.1}; // Luminance step (0 to 1) to a neighbour
+    double variance_threshold{0.005}; // Standard error that ends refinement
+};
+
+struct AdaptiveStats {
+    std::size_t base_rays{0};  // One per pixel
+    std::size_t extra_rays{0}; // Spent on refinement
+    std::size_t refined_pixels{0};
+    int rounds{0};
+};
+
+template <typename T> class AdaptiveRenderer {
+  public:
+    AdaptiveRenderer(const Scene<T> &scene, const RenderOptions &options,
+                     const AdaptiveOptions &adaptive = {})
+        : m_renderer{scene, options}, m_adaptive{adaptive},
+          m_pixels(static_cast<std::size_t>(options.width) * options.height),
+          m_active_per_tile(m_renderer.tile_count()) {}
+
+    const AdaptiveStats &stats() const { return m_stats; }
+
+    void run() {
+        m_renderer.render([&](int x, int y, const Vec3<T> &colour) {
+            add_sample(pixel(x, y), colour);
+        });
+        m_stats.base_rays = m_pixels.size();
+
+        select_by_contrast();
+
+        auto &pool{m_renderer.pool()};
+        const auto &camera{m_renderer.camera()};
+        const int max_samples{std::max(1, m_adaptive.max_samples)};
+        const int per_round{std::max(1, m_adaptive.samples_per_round)};
+
+        // Every refined pixel has taken the same number of samples, so the
+        // sample index can be shared
+        for (int first = 1; first < max_samples; first += per_round) {
+            const int last{std::min(first + per_round, max_samples)};
+
+            m_tiles.clear();
+
+            for (std::size_t i = 0; i < m_active_per_tile.size(); ++i) {
+                if (m_active_per_tile[i] > 0)
+                    m_tiles.push_back(i);
+            }
+
+            if (m_tiles.empty())
+                break;
+
+            std::vector<std::size_t> rays(m_tiles.size());
+
+            pool.parallel_for(m_tiles.size(), [&](std::size_t job) {
+                const auto tile{m_renderer.tile(m_tiles[job])};
+
+                for (int sample = first; sample < last; ++sample) {
+                    m_renderer.trace(
+                        tile, [&](int x, int y) { return pixel(x, y).active; },
+                        [&](int x, int y) {
+                            const auto [sx, sy]{sample_position(x, y, sample)};
+
+                            return camera.ray(x, y, sx, sy);
+                        },
+                        [&](int x, int y, const Vec3<T> &colour) {
+                            ++rays[job];
+                            add_sample(pixel(x, y), colour);
+                        });
+                }
+
+                auto &active{m_active_per_tile[m_tiles[job]]};
+                active = 0;
+
+                for (int y = tile.y0; y < tile.y1; ++y) {
+                    for (int x = tile.x0; x < tile.x1; ++x) {
+                        auto &p{pixel(x, y)};
+
+                        p.active = p.active && last < max_samples &&
+                                   standard_error(p) >
+                                       m_adaptive.variance_threshold;
+                        active += p.active;
+                    }
+                }
+            });
+
+            for (auto count : rays)
+                m_stats.extra_rays += count;
+
+            ++m_stats.rounds;
+        }
+    }
+
+    Image<T> image() const {
+        const auto &options{m_renderer.options()};
+        Image<T> image{options.width, options.height};
+
+        for (std::size_t i = 0; i < m_pixels.size(); ++i)
+            image.pixels[i] = Vec3<T>{m_pixels[i].mean};
+
+        return image;
+    }
+
+  private:
+    struct Accumulator {
+        std::uint32_t count{0};
+        bool active{false}; // Still taking extra samples
+        Vec3<double> mean{};
+        double luminance_mean{0}, m2{0}; // Welford state of the luminance
+    };
+
+    TileRenderer<T> m_renderer;
+    AdaptiveOptions m_adaptive;
+    std::vector<Accumulator> m_pixels;
+    std::vector<std::size_t> m_active_per_tile;
+    std::vector<std::size_t> m_tiles{};
+    AdaptiveStats m_stats{};
+
+    Accumulator &pixel(int x, int y) {
+        return m_pixels[static_cast<std::size_t>(y) *
+                            m_renderer.options().width +
+                        x];
+    }
+
+    static void add_sample(Accumulator &a, const Vec3<T> &colour) {
+        const Vec3<double> c{colour};
+
+        ++a.count;
+        a.mean += (c - a.mean) * (1.0 / a.count);
+
+        const double l{display_luminance(c)};
+        const double delta{l - a.luminance_mean};
+        a.luminance_mean += delta / a.count;
+        a.m2 += delta * (l - a.luminance_mean);
+    }
+
+    static double standard_error(const Accumulator &a) {
+        return a.count < 2 ? INF : std::sqrt(a.m2 / (a.count - 1) / a.count);
+    }
+
+    // Mark the pixels that differ too much from a neighbour, using the
+    // centre samples only
+    void select_by_contrast() {
+        const auto &options{m_renderer.options()};
+        const int width{options.width}, height{options.height};
+
+        if (m_adaptive.max_samples <= 1)
+            return;
+
+        m_renderer.pool().parallel_for(
+            m_active_per_tile.size(), [&](std::size_t index) {
+                const auto tile{m_renderer.tile(index)};
+                std::size_t active{0};
+
+                for (int y = tile.y0; y < tile.y1; ++y) {
+                    for (int x = tile.x0; x < tile.x1; ++x) {
+                        const double l{pixel(x, y).luminance_mean};
+                        double contrast{0};
+
+                        for (int ny = std::max(0, y - 1);
+                             ny <= std::min(height - 1, y + 1); ++ny) {
+                            for (int nx = std::max(0, x - 1);
+                                 nx <= std::min(width - 1, x + 1); ++nx)
+                                contrast = std::max(
+                                    contrast,
+                                    std::abs(pixel(nx, ny).luminance_mean - l));
+                        }
+
+                        pixel(x, y).active =
+                            contrast > m_adaptive.contrast_threshold;
+                        active += pixel(x, y).active;
+                    }
+                }
+
+                m_active_per_tile[index] = active;
+            });
+
+        for (auto active : m_active_per_tile)
+            m_stats.refined_pixels += active;
+    }
+};
+
+} // namespace mini_ray
+
+#endif
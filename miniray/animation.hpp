@@ -0,0 +1,486 @@
+#ifndef MINIRAY_ANIMATION_HPP
+#define MINIRAY_ANIMATION_HPP
+
+/*
+ * Incremental rendering of a sequence of frames in which spheres change
+ * between frames. Only the tiles a change can reach are retraced; every other
+ * pixel is kept from the previous frame.
+ *
+ * Which tiles a change can reach is worked out from the rays each tile
+ * actually traced. While a tile is traced, every scene query it makes
+ * (primary, reflection, refraction and shadow rays alike) reports the segment
+ * of space it covered, see ray_recorder.hpp, and the voxels of a coarse grid
+ * the segment passes through are remembered for the tile. A query can only
+ * give a different answer if a sphere that changed lies in, or has moved
+ * into, that segment, so a tile is retraced when the old or new bounds of a
+ * changed sphere overlap one of its voxels. Segments leaving the grid are
+ * summarised by one flag per tile, which makes every such tile depend on
+ * everything outside the grid.
+ *
+ * This is conservative: a retraced tile may come out unchanged, but a tile
+ * that is reused is bit for bit what a full render of the frame would give.
+ * Changing a light retraces the whole frame, as every diffuse hit depends on
+ * every light.
+ *
+ * The scene itself is kept between frames and refitted to the moved spheres
+ * rather than rebuilt. Refitting keeps the BVH topology, whose SAH cost
+ * grows as spheres drift from where it was built for; once it has grown past
+ * a threshold a new scene is built on a background thread from a copy of the
+ * spheres, and frames keep using the refitted one until it is ready. Any
+ * tree gives the same hits, so none of this changes the images.
+ */
+#include "bvh.hpp"
+#include "image.hpp"
+#include "ray_recorder.hpp"
+#include "scene.hpp"
+#include "sphere.hpp"
+#include "tile_renderer.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+struct AnimationOptions {
+    int grid_resolution{32}; // Voxels along each axis of the grid
+    // Region the grid covers. Left empty, it is fitted around the camera
+    // and the spheres of the first frame, leaving out spheres far larger
+    // than the rest (such as a ground sphere), with room for them to move.
+    Aabb<double> bounds{};
+    // A rebuild starts once the SAH cost of the refitted BVH exceeds the
+    // cost it had when built by this fraction
+    double rebuild_threshold{0.25};
+};
+
+struct AnimationStats {
+    std::size_t frames{0};
+    std::size_t traced_tiles{0}, reused_tiles{0}; // Over every frame
+    std::size_t last_traced_tiles{0};             // In the latest frame
+    std::size_t refits{0};
+    std::size_t rebuilds{0}; // Background rebuilds swapped in
+    double sah_cost{0};      // Of the BVH used for the latest frame
+};
+
+// For each tile, the voxels of a uniform grid its rays passed through, and
+// the voxels changed since the tiles were last traced. Tiles are recorded
+// concurrently, but each by one thread only.
+class DependencyGrid {
+  public:
+    DependencyGrid() = default;
+
+    DependencyGrid(const Aabb<double> &bounds, int resolution,
+                   std::size_t tiles)
+        : m_bounds{bounds}, m_resolution{std::max(1, resolution)},
+          m_words{(static_cast<std::size_t>(m_resolution) * m_resolution *
+                       m_resolution +
+                   63) /
+                  64},
+          m_reached(tiles * m_words), m_escapes(tiles),
+          m_changed(m_words) {
+        const auto extent{bounds.max - bounds.min};
+
+        m_voxel[0] = extent.x / m_resolution;
+        m_voxel[1] = extent.y / m_resolution;
+        m_voxel[2] = extent.z / m_resolution;
+    }
+
+    std::size_t tiles() const { return m_escapes.size(); }
+
+    // Forget what a tile depends on, before it is traced again
+    void clear(std::size_t tile) {
+        std::fill_n(m_reached.begin() + tile * m_words, m_words, 0);
+        m_escapes[tile] = false;
+    }
+
+    // The tile depends on ray_orig + t * ray_dir for t in [0, t_end]. Cells
+    // are found by walking the grid (Amanatides and Woo).
+    void record(std::size_t tile, const Vec3<double> &ray_orig,
+                const Vec3<double> &ray_dir, double t_end) {
+        const double o[3]{ray_orig.x, ray_orig.y, ray_orig.z};
+        const double d[3]{ray_dir.x, ray_dir.y, ray_dir.z};
+        const double lo[3]{m_bounds.min.x, m_bounds.min.y, m_bounds.min.z};
+        const double hi[3]{m_bounds.max.x, m_bounds.max.y, m_bounds.max.z};
+
+        // A NaN ray hits nothing, whatever the scene holds
+        if (std::isnan(t_end) || std::isnan(o[0] + o[1] + o[2]) ||
+            std::isnan(d[0] + d[1] + d[2]))
+            return;
+
+        double t_enter{0}, t_exit{t_end};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (d[axis] == 0) {
+                if (o[axis] < lo[axis] || o[axis] > hi[axis])
+                    t_exit = -1;
+
+                continue;
+            }
+
+            double t0{(lo[axis] - o[axis]) / d[axis]};
+            double t1{(hi[axis] - o[axis]) / d[axis]};
+
+            if (t0 > t1)
+                std::swap(t0, t1);
+
+            t_enter = std::max(t_enter, t0);
+            t_exit = std::min(t_exit, t1);
+        }
+
+        if (t_enter > 0 || t_exit < t_end)
+            m_escapes[tile] = true;
+
+        if (t_enter > t_exit)
+            return;
+
+        int cell[3], step[3];
+        double next[3], delta[3];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const double p{o[axis] + d[axis] * t_enter};
+
+            cell[axis] = voxel(axis, p);
+
+            if (d[axis] > 0) {
+                step[axis] = 1;
+                next[axis] =
+                    (lo[axis] + (cell[axis] + 1) * m_voxel[axis] - o[axis]) /
+                    d[axis];
+                delta[axis] = m_voxel[axis] / d[axis];
+            } else if (d[axis] < 0) {
+                step[axis] = -1;
+                next[axis] =
+                    (lo[axis] + cell[axis] * m_voxel[axis] - o[axis]) /
+                    d[axis];
+                delta[axis] = -m_voxel[axis] / d[axis];
+            } else {
+                step[axis] = 0;
+                next[axis] = std::numeric_limits<double>::infinity();
+                delta[axis] = next[axis];
+            }
+        }
+
+        std::uint64_t *reached{m_reached.data() + tile * m_words};
+
+        while (true) {
+            const auto bit{index(cell[0], cell[1], cell[2])};
+            reached[bit / 64] |= std::uint64_t{1} << bit % 64;
+
+            const int axis{next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+                                             : (next[1] < next[2] ? 1 : 2)};
+
+            if (next[axis] > t_exit)
+                break;
+
+            cell[axis] += step[axis];
+
+            if (cell[axis] < 0 || cell[axis] >= m_resolution)
+                break;
+
+            next[axis] += delta[axis];
+        }
+    }
+
+    // Something inside region changed. The region is grown by a voxel on
+    // every side to absorb rounding in the walk above.
+    void change(const Aabb<double> &region) {
+        const double lo[3]{region.min.x, region.min.y, region.min.z};
+        const double hi[3]{region.max.x, region.max.y, region.max.z};
+        const double box_lo[3]{m_bounds.min.x, m_bounds.min.y,
+                               m_bounds.min.z};
+        const double box_hi[3]{m_bounds.max.x, m_bounds.max.y,
+                               m_bounds.max.z};
+        int first[3], last[3];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!(lo[axis] <= hi[axis]))
+                return change_everything();
+
+            if (lo[axis] < box_lo[axis] || hi[axis] > box_hi[axis])
+                m_changed_outside = true;
+
+            first[axis] = std::max(0, voxel(axis, lo[axis]) - 1);
+            last[axis] = std::min(m_resolution - 1, voxel(axis, hi[axis]) + 1);
+        }
+
+        for (int z = first[2]; z <= last[2]; ++z) {
+            for (int y = first[1]; y <= last[1]; ++y) {
+                for (int x = first[0]; x <= last[0]; ++x) {
+                    const auto bit{index(x, y, z)};
+                    m_changed[bit / 64] |= std::uint64_t{1} << bit % 64;
+                }
+            }
+        }
+    }
+
+    void change_everything() { m_changed_everything = true; }
+
+    // True if the tile may see one of the changes
+    bool affected(std::size_t tile) const {
+        if (m_changed_everything || (m_changed_outside && m_escapes[tile]))
+            return true;
+
+        const std::uint64_t *reached{m_reached.data() + tile * m_words};
+
+        for (std::size_t i = 0; i < m_words; ++i) {
+            if (reached[i] & m_changed[i])
+                return true;
+        }
+
+        return false;
+    }
+
+    // Start collecting the changes of the next frame
+    void reset_changes() {
+        std::fill(m_changed.begin(), m_changed.end(), 0);
+        m_changed_outside = false;
+        m_changed_everything = false;
+    }
+
+  private:
+    Aabb<double> m_bounds{};
+    int m_resolution{1};
+    double m_voxel[3]{};
+    std::size_t m_words{0}; // Per tile
+    std::vector<std::uint64_t> m_reached{};
+    // One byte per tile, so that tiles can be written concurrently
+    std::vector<unsigned char> m_escapes{};
+    std::vector<std::uint64_t> m_changed{};
+    bool m_changed_outside{false}, m_changed_everything{false};
+
+    // Voxel of coordinate p along axis, clamped to the grid
+    int voxel(int axis, double p) const {
+        const double lo{axis == 0   ? m_bounds.min.x
+                        : axis == 1 ? m_bounds.min.y
+                                    : m_bounds.min.z};
+        const double cell{std::floor((p - lo) / m_voxel[axis])};
+
+        return static_cast<int>(
+            std::clamp(cell, 0.0, static_cast<double>(m_resolution - 1)));
+    }
+
+    std::size_t index(int x, int y, int z) const {
+        return (static_cast<std::size_t>(z) * m_resolution + y) *
+                   m_resolution +
+               x;
+    }
+};
+
+namespace animation_detail {
+
+// Records the queries of one tile into the grid
+template <typename T> class TileRecorder final : public RayRecorder<T> {
+  public:
+    TileRecorder(DependencyGrid &grid, std::size_t tile)
+        : m_grid{grid}, m_tile{tile} {}
+
+    void record(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                T t_end) override {
+        m_grid.record(m_tile, Vec3<double>{ray_orig}, Vec3<double>{ray_dir},
+                      static_cast<double>(t_end));
+    }
+
+  private:
+    DependencyGrid &m_grid;
+    std::size_t m_tile;
+};
+
+// Matches what LightList counts as a light
+template <typename T> bool is_light(const Sphere<T> &sphere) {
+    return sphere.emission_colour.x > 0;
+}
+
+template <typename T> Aabb<double> bounds(const Sphere<T> &sphere) {
+    const Vec3<double> centre{sphere.centre};
+    const Vec3<double> extent{static_cast<double>(sphere.radius)};
+
+    return Aabb<double>{centre - extent, centre + extent};
+}
+
+// See AnimationOptions::bounds
+template <typename T>
+Aabb<double> fit_grid(const std::vector<Sphere<T>> &spheres,
+                      const Vec3<double> &camera) {
+    std::vector<T> radii{};
+
+    for (const auto &sphere : spheres)
+        radii.push_back(sphere.radius);
+
+    T limit{std::numeric_limits<T>::infinity()};
+
+    if (!radii.empty()) {
+        const auto median{radii.begin() + radii.size() / 2};
+        std::nth_element(radii.begin(), median, radii.end());
+        limit = *median * 100;
+    }
+
+    Aabb<double> box{};
+    box.grow(camera);
+
+    for (const auto &sphere : spheres) {
+        if (sphere.radius <= limit)
+            box.grow(bounds(sphere));
+    }
+
+    const auto extent{box.max - box.min};
+    const double pad{
+        std::max({extent.x, extent.y, extent.z, 1.0}) * 0.25};
+
+    return Aabb<double>{box.min - Vec3<double>{pad},
+                        box.max + Vec3<double>{pad}};
+}
+
+} // namespace animation_detail
+
+// Renders frames of a changing list of spheres, from a fixed camera with
+// fixed render options
+template <typename T> class Animation {
+  public:
+    explicit Animation(std::vector<Sphere<T>> spheres,
+                       const RenderOptions &options = {},
+                       const AnimationOptions &animation = {})
+        : m_spheres{std::move(spheres)}, m_options{options},
+          m_animation{animation}, m_image{options.width, options.height} {}
+
+    const std::vector<Sphere<T>> &spheres() const { return m_spheres; }
+    const Image<T> &image() const { return m_image; }
+    const AnimationStats &stats() const { return m_stats; }
+
+    // Replace the sphere given at index for the next frame
+    void update(std::size_t index, const Sphere<T> &sphere) {
+        auto &current{m_spheres.at(index)};
+
+        // Before the first frame everything is traced anyway
+        if (m_stats.frames == 0) {
+            current = sphere;
+            return;
+        }
+
+        m_moved = true;
+
+        if (animation_detail::is_light(current) ||
+            animation_detail::is_light(sphere)) {
+            m_grid.change_everything();
+        } else {
+            m_grid.change(animation_detail::bounds(current));
+            m_grid.change(animation_detail::bounds(sphere));
+        }
+
+        current = sphere;
+    }
+
+    // Bring image() up to date with the spheres. The first frame traces
+    // every tile.
+    const Image<T> &render_frame() {
+        update_scene();
+
+        const Scene<T> &scene{*m_scene};
+        TileRenderer<T> renderer{scene, m_options};
+
+        if (m_stats.frames == 0) {
+            auto bounds{m_animation.bounds};
+
+            if (!(bounds.min.x <= bounds.max.x))
+                bounds = animation_detail::fit_grid(m_spheres,
+                                                    Vec3<double>{});
+
+            m_grid = DependencyGrid{bounds, m_animation.grid_resolution,
+                                    renderer.tile_count()};
+            m_grid.change_everything();
+        }
+
+        std::vector<std::size_t> dirty{};
+
+        for (std::size_t i = 0; i < renderer.tile_count(); ++i) {
+            if (m_grid.affected(i))
+                dirty.push_back(i);
+        }
+
+        renderer.pool().parallel_for(dirty.size(), [&](std::size_t i) {
+            const auto index{dirty[i]};
+            animation_detail::TileRecorder<T> recorder{m_grid, index};
+            const RecordRays<T> recording{recorder};
+
+            m_grid.clear(index);
+            renderer.trace(
+                renderer.tile(index), [](int, int) { return true; },
+                [&](int x, int y) { return renderer.camera().ray(x, y); },
+                [&](int x, int y, const Vec3<T> &colour) {
+                    m_image.at(x, y) = colour;
+                });
+        });
+
+        m_grid.reset_changes();
+        ++m_stats.frames;
+        m_stats.last_traced_tiles = dirty.size();
+        m_stats.traced_tiles += dirty.size();
+        m_stats.reused_tiles += renderer.tile_count() - dirty.size();
+
+        return m_image;
+    }
+
+  private:
+    std::vector<Sphere<T>> m_spheres;
+    RenderOptions m_options;
+    AnimationOptions m_animation;
+    Image<T> m_image;
+    DependencyGrid m_grid{};
+    AnimationStats m_stats{};
+    std::optional<Scene<T>> m_scene{};
+    bool m_moved{false}; // Since the scene was last refitted
+    double m_built_cost{0}; // SAH cost of the BVH as built
+    std::future<Scene<T>> m_rebuild{};
+
+    // Bring the scene up to date with the spheres for the next frame
+    void update_scene() {
+        if (!m_scene) {
+            m_scene.emplace(m_spheres);
+            m_built_cost = m_scene->bvh().sah_cost();
+            m_stats.sah_cost = m_built_cost;
+            return;
+        }
+
+        // A finished rebuild was made from spheres that may have moved since
+        if (m_rebuild.valid() &&
+            m_rebuild.wait_for(std::chrono::seconds{0}) ==
+                std::future_status::ready) {
+            m_scene.emplace(m_rebuild.get());
+            m_scene->refit(m_spheres);
+            m_built_cost = m_scene->bvh().sah_cost();
+            m_moved = false;
+            ++m_stats.rebuilds;
+        }
+
+        if (m_moved) {
+            m_scene->refit(m_spheres);
+            m_moved = false;
+            ++m_stats.refits;
+        }
+
+        m_stats.sah_cost = m_scene->bvh().sah_cost();
+
+        // The grid is rebuilt by every refit, and the BVH quality matters
+        // only when it answers queries
+        if (!m_rebuild.valid() &&
+            m_scene->accelerator() == Accelerator::bvh &&
+            m_stats.sah_cost >
+                m_built_cost * (1 + m_animation.rebuild_threshold)) {
+            m_rebuild = std::async(std::launch::async,
+                                   [spheres = m_spheres] {
+                                       return Scene<T>{spheres};
+                                   });
+        }
+    }
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,740 @@
+/*
+ * Benchmarks for the renderer, printed as one JSON document on stdout so
+ * results can be stored and compared between revisions:
+ *
+ * - vec3_normalise and sphere_intersect time the innermost operations
+ * - rng_uniform and rng_fill time the random streams drawn one number at a
+ *   time and in SIMD batches
+ * - framebuffer_<format>_<layout> stores a frame tile by tile and encodes
+ *   it for output, in each framebuffer pixel format and layout
+ * - trace runs the primary rays of a small frame of the demo scene through
+ *   trace() entered at each depth, so deeper entries recurse less
+ * - denoise filters a one sample frame with 1, 3 and 5 iterations
+ * - pixel_order_<order> renders up to 100000 spheres on one thread in each
+ *   pixel order, and where the kernel exposes hardware counters reports L1
+ *   data cache, last level cache and branch misses per ray
+ * - accelerator_<bvh|grid> renders random spheres on one thread through
+ *   each acceleration structure, with similar sizes and with sizes spread
+ *   over two orders of magnitude, noting which one automatic would pick
+ * - bvh_build times building the BVH of up to 10 million random spheres
+ *   with 1, 2, 4, ... threads up to --max-threads
+ * - scene_build times building a scene of random spheres, and scene_refit
+ *   refitting it after every sphere has moved
+ * - render times render_image() while sweeping the sphere count at a fixed
+ *   resolution, the resolution and the thread count at a fixed scene
+ *
+ * Every case repeats until it has run for at least --min-time seconds and
+ * reports the mean. Render rates count primary rays only.
+ */
+#include "miniray.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    double min_time{0.25}; // Seconds per case
+    std::size_t max_spheres{1000000};
+    unsigned int max_threads{
+        std::max(1u, std::thread::hardware_concurrency())};
+    bool single{true}, double_precision{true};
+};
+
+// Results are folded into this so the work cannot be optimised away
+volatile double sink{0};
+
+// Run once to warm up, then repeatedly until min_time has passed. run()
+// returns how many operations it performed. Returns (operations, seconds).
+template <typename Run>
+std::pair<std::size_t, double> measure(double min_time, Run &&run) {
+    run();
+
+    std::size_t operations{0};
+    const auto start{Clock::now()};
+    double elapsed{0};
+
+    do {
+        operations += run();
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < min_time);
+
+    return {operations, elapsed};
+}
+
+bool avx2() {
+#ifdef MINIRAY_AVX2_KERNEL
+    return mini_ray::avx2_supported();
+#else
+    return false;
+#endif
+}
+
+class Report {
+  public:
+    // One result; unit names what was counted ("ray" gives rays,
+    // rays_per_second and ns_per_ray)
+    void add(const std::string &name, const char *precision,
+             std::initializer_list<std::pair<const char *, double>> params,
+             const char *unit, std::pair<std::size_t, double> result,
+             std::initializer_list<std::pair<const char *, double>> extra =
+                 {}) {
+        const auto [operations, seconds]{result};
+        std::string entry{"    {\"name\": \"" + name +
+                          "\", \"precision\": \"" + precision + "\""};
+
+        for (const auto &[key, value] : params)
+            entry += ", \"" + std::string{key} + "\": " + number(value);
+
+        const std::string plural{std::string{unit} + "s"};
+
+        entry += ", \"" + plural + "\": " + std::to_string(operations) +
+                 ", \"seconds\": " + number(seconds) + ", \"" + plural +
+                 "_per_second\": " + number(operations / seconds) +
+                 ", \"ns_per_" + unit +
+                 "\": " + number(1e9 * seconds / operations);
+
+        for (const auto &[key, value] : extra)
+            entry += ", \"" + std::string{key} + "\": " + number(value);
+
+        entry += "}";
+
+        m_entries.push_back(entry);
+    }
+
+    void print(std::ostream &os, const BenchOptions &options) const {
+        os << "{\n  \"min_time\": " << number(options.min_time)
+           << ",\n  \"hardware_threads\": "
+           << std::thread::hardware_concurrency()
+           << ",\n  \"avx2\": " << (avx2() ? "true" : "false")
+           << ",\n  \"results\": [\n";
+
+        for (std::size_t i = 0; i < m_entries.size(); ++i)
+            os << m_entries[i] << (i + 1 < m_entries.size() ? ",\n" : "\n");
+
+        os << "  ]\n}" << std::endl;
+    }
+
+  private:
+    std::vector<std::string> m_entries{};
+
+    static std::string number(double value) {
+        if (!std::isfinite(value))
+            return "null";
+
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+
+        return buffer;
+    }
+};
+
+// Hardware events counted for this process and every thread it starts
+// while counting, through perf_event_open on Linux. Generic perf events
+// name the L1 data cache and the last level cache but not L2, so those two
+// are what is reported. Counts are NaN (null in the report) where the
+// kernel or the hardware does not provide them, e.g. in most containers.
+class EventCounters {
+  public:
+    // L1 data cache read misses, last level cache read misses and branch
+    // misses, in that order
+    static constexpr std::size_t COUNT{3};
+
+    EventCounters() {
+#ifdef __linux__
+        const auto cache_miss = [](std::uint64_t cache) {
+            return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                   PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        };
+        const std::pair<std::uint32_t, std::uint64_t> events[COUNT]{
+            {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+            {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.disabled = 1;
+            attr.inherit = 1; // Follow the threads of the pools started
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            m_fds[i] = static_cast<int>(
+                syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    EventCounters(const EventCounters &) = delete;
+    EventCounters &operator=(const EventCounters &) = delete;
+
+    ~EventCounters() {
+#ifdef __linux__
+        for (int fd : m_fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+
+    // Counts of threads started after start() are included once they exit
+    void start() {
+#ifdef __linux__
+        for (int fd : m_fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    std::array<double, COUNT> stop() {
+        std::array<double, COUNT> counts{};
+        counts.fill(std::nan(""));
+#ifdef __linux__
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            std::uint64_t value{};
+
+            if (m_fds[i] >= 0) {
+                ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+                if (read(m_fds[i], &value, sizeof(value)) == sizeof(value))
+                    counts[i] = static_cast<double>(value);
+            }
+        }
+#endif
+        return counts;
+    }
+
+  private:
+    int m_fds[COUNT]{-1, -1, -1};
+};
+
+double uniform(std::uint64_t &state) {
+    return static_cast<double>(mini_ray::hash(state++) >> 11) * 0x1p-53;
+}
+
+// count spheres spread through a box in front of the camera that grows with
+// the count, so density and the share of the frame they cover stay similar.
+// The first sphere is the light.
+template <typename T>
+std::vector<mini_ray::Sphere<T>> random_spheres(std::size_t count) {
+    using mini_ray::Vec3;
+
+    std::vector<mini_ray::Sphere<T>> spheres{};
+    std::uint64_t state{count};
+    const double side{2 * std::cbrt(static_cast<double>(count)) + 4};
+
+    spheres.reserve(count);
+    spheres.emplace_back(Vec3<T>{0, static_cast<T>(side), -15}, 2, Vec3<T>{},
+                         0, 0, Vec3<T>{3});
+
+    while (spheres.size() < count) {
+        const Vec3<T> centre{
+            static_cast<T>((uniform(state) - 0.5) * side),
+            static_cast<T>((uniform(state) - 0.5) * side),
+            static_cast<T>(-15 - uniform(state) * side)};
+        const Vec3<T> colour{static_cast<T>(uniform(state)),
+                             static_cast<T>(uniform(state)),
+                             static_cast<T>(uniform(state))};
+        const bool shiny{uniform(state) < 0.2};
+
+        const T radius{static_cast<T>(0.3 + 0.5 * uniform(state))};
+
+        spheres.emplace_back(centre, radius, colour, shiny ? 1 : 0, 0);
+    }
+
+    return spheres;
+}
+
+template <typename T>
+void bench_kernels(Report &report, const BenchOptions &options,
+                   const char *precision) {
+    using mini_ray::Vec3;
+
+    constexpr std::size_t count{4096};
+    std::uint64_t state{1};
+    std::vector<Vec3<T>> vectors{};
+
+    for (std::size_t i = 0; i < count; ++i)
+        vectors.emplace_back(static_cast<T>(uniform(state) - 0.5),
+                             static_cast<T>(uniform(state) - 0.5),
+                             static_cast<T>(uniform(state) - 1));
+
+    report.add("vec3_normalise", precision, {}, "call",
+               measure(options.min_time, [&] {
+                   T sum{0};
+
+                   for (auto v : vectors)
+                       sum += v.normalise().x;
+
+                   sink = sink + sum;
+                   return count;
+               }));
+
+    // Directions from the origin towards a unit sphere at z = -5, about
+    // half of which hit it
+    const mini_ray::Sphere<T> sphere{Vec3<T>{0, 0, -5}, 1, Vec3<T>{1}};
+
+    for (auto &v : vectors)
+        v = Vec3<T>{v.x / 2, v.y / 2, -1}.normalise();
+
+    report.add("sphere_intersect", precision, {}, "test",
+               measure(options.min_time, [&] {
+                   T sum{0};
+
+                   for (const auto &direction : vectors) {
+                       T t0{}, t1{};
+
+                       if (sphere.intersect(Vec3<T>{}, direction, t0, t1))
+                           sum += t0;
+                   }
+
+                   sink = sink + sum;
+                   return count;
+               }));
+
+    // One stream per pixel as sample_position() uses them, then words of
+    // one long stream drawn in batches
+    report.add("rng_uniform", precision, {}, "draw",
+               measure(options.min_time, [&] {
+                   T sum{0};
+
+                   for (std::uint32_t i = 0; i < count; ++i) {
+                       mini_ray::Rng rng{i % 64, i / 64, 1};
+                       sum += rng.uniform<T>() + rng.uniform<T>();
+                   }
+
+                   sink = sink + sum;
+                   return 2 * count;
+               }));
+
+    std::vector<std::uint32_t> words(count);
+    mini_ray::Rng stream{0, 0, 0};
+
+    report.add("rng_fill", precision, {}, "word",
+               measure(options.min_time, [&] {
+                   stream.fill(words.data(), words.size());
+
+                   sink = sink + words[count / 2];
+                   return count;
+               }));
+}
+
+template <typename T>
+void bench_trace(Report &report, const BenchOptions &options,
+                 const char *precision) {
+    using mini_ray::Vec3;
+
+    constexpr int width{160}, height{120};
+    const mini_ray::Scene<T> scene{
+        mini_ray::convert<T>(mini_ray::demo_spheres())};
+    const mini_ray::Camera<T> camera{width, height};
+    std::vector<Vec3<T>> directions{};
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x)
+            directions.push_back(camera.ray(x, y));
+    }
+
+    for (int depth = 0; depth <= MAX_DEPTH; ++depth) {
+        report.add("trace", precision, {{"depth", depth}}, "ray",
+                   measure(options.min_time, [&] {
+                       T sum{0};
+
+                       for (const auto &direction : directions)
+                           sum += mini_ray::trace(Vec3<T>{}, direction, scene,
+                                                  depth)
+                                      .x;
+
+                       sink = sink + sum;
+                       return directions.size();
+                   }));
+    }
+}
+
+// Store a 1080p frame tile by tile in each framebuffer format and layout,
+// then encode it to PPM rows as FrameWriter does
+template <typename T>
+void bench_framebuffer(Report &report, const BenchOptions &options,
+                       const char *precision) {
+    using mini_ray::PixelFormat;
+    using mini_ray::PixelLayout;
+
+    constexpr int width{1920}, height{1080}, tile{32};
+    std::vector<mini_ray::Vec3<T>> colours(width);
+    std::uint64_t state{1};
+
+    for (auto &colour : colours)
+        colour = mini_ray::Vec3<T>{static_cast<T>(uniform(state)),
+                                   static_cast<T>(uniform(state)),
+                                   static_cast<T>(uniform(state))};
+
+    const std::pair<const char *, PixelFormat> formats[]{
+        {"double", PixelFormat::rgb_double},
+        {"float", PixelFormat::rgb_float},
+        {"half", PixelFormat::rgb_half},
+        {"rgbe", PixelFormat::rgbe}};
+    const std::pair<const char *, PixelLayout> layouts[]{
+        {"scanline", PixelLayout::scanline},
+        {"tiled", PixelLayout::tiled},
+        {"morton", PixelLayout::morton}};
+
+    for (const auto &[format_name, format] : formats) {
+        for (const auto &[layout_name, layout] : layouts) {
+            mini_ray::Framebuffer frame{width, height, format, layout, tile};
+            std::vector<unsigned char> bytes{};
+
+            report.add(std::string{"framebuffer_"} + format_name + "_" +
+                           layout_name,
+                       precision,
+                       {{"bytes_per_pixel",
+                         static_cast<double>(frame.bytes()) /
+                             (width * height)}},
+                       "pixel", measure(options.min_time, [&] {
+                           for (int y0 = 0; y0 < height; y0 += tile) {
+                               for (int x0 = 0; x0 < width; x0 += tile) {
+                                   for (int y = y0;
+                                        y < std::min(y0 + tile, height); ++y) {
+                                       for (int x = x0; x < x0 + tile; ++x)
+                                           frame.store(x, y, colours[x]);
+                                   }
+                               }
+                           }
+
+                           mini_ray::encode_rows(frame, 0, height, bytes);
+
+                           sink = sink + bytes[bytes.size() / 2];
+                           return static_cast<std::size_t>(width) * height;
+                       }));
+        }
+    }
+}
+
+// The denoiser on a one sample frame of the demo scene, per iteration count
+template <typename T>
+void bench_denoise(Report &report, const BenchOptions &options,
+                   const char *precision) {
+    constexpr int width{320}, height{240};
+    const mini_ray::Scene<T> scene{
+        mini_ray::convert<T>(mini_ray::demo_spheres())};
+    mini_ray::RenderOptions render_options{};
+    render_options.width = width;
+    render_options.height = height;
+    render_options.threads = options.max_threads;
+
+    mini_ray::ProgressiveOptions progressive{};
+    progressive.min_samples = progressive.max_samples = 1;
+
+    const auto image{
+        mini_ray::render_progressive(scene, render_options, progressive)};
+    const auto guides{
+        mini_ray::render_guides(scene, width, height, options.max_threads)};
+
+    for (int iterations : {1, 3, 5}) {
+        mini_ray::DenoiseOptions denoise_options{};
+        denoise_options.iterations = iterations;
+        denoise_options.threads = options.max_threads;
+
+        report.add("denoise", precision, {{"iterations", iterations}},
+                   "pixel", measure(options.min_time, [&] {
+                       const auto filtered{mini_ray::denoise(
+                           image, guides, denoise_options)};
+
+                       sink = sink + filtered.pixels[0].x;
+                       return filtered.pixels.size();
+                   }));
+    }
+}
+
+// Render a large scene on one thread with the pixels of each tile traced in
+// every pixel order, with and without packets, counting cache and branch
+// misses per primary ray
+template <typename T>
+void bench_pixel_order(Report &report, const BenchOptions &options,
+                       const char *precision) {
+    using mini_ray::PixelOrder;
+
+    constexpr int width{320}, height{240};
+    const std::size_t count{std::min<std::size_t>(options.max_spheres,
+                                                  100000)};
+    const mini_ray::Scene<T> scene{random_spheres<T>(count)};
+    const std::pair<const char *, PixelOrder> orders[]{
+        {"scanline", PixelOrder::scanline},
+        {"tiled", PixelOrder::tiled},
+        {"morton", PixelOrder::morton},
+        {"hilbert", PixelOrder::hilbert}};
+
+    for (bool packets : {false, true}) {
+        for (const auto &[name, order] : orders) {
+            mini_ray::RenderOptions render_options{};
+            render_options.width = width;
+            render_options.height = height;
+            render_options.threads = 1;
+            render_options.packets = packets;
+            render_options.pixel_order = order;
+
+            EventCounters counters{};
+            counters.start();
+
+            const auto result{measure(options.min_time, [&] {
+                const auto image{
+                    mini_ray::render_image(scene, render_options)};
+
+                sink = sink + image.pixels[0].x;
+                return image.pixels.size();
+            })};
+            const auto events{counters.stop()};
+            // The warm up render in measure() is counted too
+            const double rays{static_cast<double>(result.first) +
+                              width * height};
+
+            report.add(std::string{"pixel_order_"} + name, precision,
+                       {{"spheres", static_cast<double>(count)},
+                        {"packets", packets}},
+                       "ray", result,
+                       {{"l1d_misses_per_ray", events[0] / rays},
+                        {"llc_misses_per_ray", events[1] / rays},
+                        {"branch_misses_per_ray", events[2] / rays}});
+        }
+    }
+}
+
+// Both acceleration structures over the same spheres, first as generated
+// and then with radii scaled by up to 30 times, which a grid handles badly
+template <typename T>
+void bench_accelerator(Report &report, const BenchOptions &options,
+                       const char *precision) {
+    using mini_ray::Accelerator;
+
+    const std::pair<const char *, Accelerator> accelerators[]{
+        {"bvh", Accelerator::bvh}, {"grid", Accelerator::grid}};
+
+    for (bool mixed : {false, true}) {
+        for (std::size_t count = 1000; count <= options.max_spheres;
+             count *= 10) {
+            auto spheres{random_spheres<T>(count)};
+            std::uint64_t state{count};
+
+            for (std::size_t i = 1; mixed && i < spheres.size(); ++i) {
+                const auto &s{spheres[i]};
+                const T scale{static_cast<T>(
+                    std::pow(30.0, uniform(state) * uniform(state)))};
+
+                spheres[i] = mini_ray::Sphere<T>{
+                    s.centre,       s.radius * scale, s.surface_colour,
+                    s.reflection,   s.transparency,   s.emission_colour};
+            }
+
+            const bool automatic_grid{
+                mini_ray::Scene<T>{spheres}.accelerator() ==
+                Accelerator::grid};
+
+            for (const auto &[name, accelerator] : accelerators) {
+                const mini_ray::Scene<T> scene{spheres, accelerator};
+                mini_ray::RenderOptions render_options{};
+                render_options.width = 320;
+                render_options.height = 240;
+                render_options.threads = 1;
+
+                report.add(std::string{"accelerator_"} + name, precision,
+                           {{"spheres", static_cast<double>(count)},
+                            {"mixed", mixed}},
+                           "ray", measure(options.min_time, [&] {
+                               const auto image{mini_ray::render_image(
+                                   scene, render_options)};
+
+                               sink = sink + image.pixels[0].x;
+                               return image.pixels.size();
+                           }),
+                           {{"automatic_grid", automatic_grid}});
+            }
+        }
+    }
+}
+
+// The BVH alone over the bounds of the spheres, for every thread count
+template <typename T>
+void bench_build(Report &report, const BenchOptions &options,
+                 const char *precision) {
+    const std::size_t count{std::min<std::size_t>(options.max_spheres,
+                                                  10000000)};
+    const auto spheres{random_spheres<T>(count)};
+    std::vector<mini_ray::Aabb<T>> bounds{};
+    bounds.reserve(count);
+
+    for (const auto &sphere : spheres) {
+        const mini_ray::Vec3<T> extent{sphere.radius};
+        bounds.push_back(
+            mini_ray::Aabb<T>{sphere.centre - extent, sphere.centre + extent});
+    }
+
+    std::vector<unsigned int> thread_counts{};
+
+    for (unsigned int threads = 1; threads < options.max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+
+    thread_counts.push_back(options.max_threads);
+
+    for (unsigned int threads : thread_counts) {
+        mini_ray::ThreadPool pool{threads};
+
+        report.add("bvh_build", precision,
+                   {{"spheres", static_cast<double>(count)},
+                    {"threads", threads}},
+                   "build", measure(options.min_time, [&] {
+                       const mini_ray::Bvh<T> bvh{bounds, &pool};
+
+                       sink = sink + bvh.nodes().size();
+                       return 1;
+                   }));
+    }
+}
+
+template <typename T>
+void bench_render(Report &report, const BenchOptions &options,
+                  const char *precision) {
+    const auto render = [&](const mini_ray::Scene<T> &scene,
+                            std::size_t spheres, int width, int height,
+                            unsigned int threads) {
+        mini_ray::RenderOptions render_options{};
+        render_options.width = width;
+        render_options.height = height;
+        render_options.threads = threads;
+
+        report.add("render", precision,
+                   {{"spheres", static_cast<double>(spheres)},
+                    {"width", width},
+                    {"height", height},
+                    {"threads", threads}},
+                   "ray", measure(options.min_time, [&] {
+                       const auto image{
+                           mini_ray::render_image(scene, render_options)};
+
+                       sink = sink + image.pixels[0].x;
+                       return image.pixels.size();
+                   }));
+    };
+
+    constexpr std::size_t sweep_spheres{1000};
+    const unsigned int all{options.max_threads};
+
+    for (std::size_t count = 1; count <= options.max_spheres; count *= 10) {
+        const auto spheres{random_spheres<T>(count)};
+        report.add("scene_build", precision,
+                   {{"spheres", static_cast<double>(count)}}, "build",
+                   measure(options.min_time, [&] {
+                       const mini_ray::Scene<T> scene{spheres};
+
+                       sink = sink + scene.bvh().nodes().size();
+                       return 1;
+                   }));
+
+        auto moved{spheres};
+
+        for (auto &sphere : moved)
+            sphere.centre.y += static_cast<T>(0.5);
+
+        mini_ray::Scene<T> refitted{spheres};
+        report.add("scene_refit", precision,
+                   {{"spheres", static_cast<double>(count)}}, "refit",
+                   measure(options.min_time, [&] {
+                       refitted.refit(moved);
+
+                       sink = sink + refitted.bvh().nodes()[0].bounds.max.y;
+                       return 1;
+                   }));
+
+        const mini_ray::Scene<T> scene{spheres};
+
+        render(scene, count, 320, 240, all);
+
+        if (count != sweep_spheres)
+            continue;
+
+        for (int width : {160, 640, 1280})
+            render(scene, count, width, width * 3 / 4, all);
+
+        for (unsigned int threads = 1; threads < all; threads *= 2)
+            render(scene, count, 640, 480, threads);
+    }
+}
+
+template <typename T>
+void bench(Report &report, const BenchOptions &options,
+           const char *precision) {
+    bench_kernels<T>(report, options, precision);
+    bench_framebuffer<T>(report, options, precision);
+    bench_trace<T>(report, options, precision);
+    bench_denoise<T>(report, options, precision);
+    bench_pixel_order<T>(report, options, precision);
+    bench_accelerator<T>(report, options, precision);
+    bench_build<T>(report, options, precision);
+    bench_render<T>(report, options, precision);
+}
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+    BenchOptions options{};
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_time = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-spheres") == 0 &&
+                   i + 1 < argc) {
+            options.max_spheres = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--max-threads") == 0 &&
+                   i + 1 < argc) {
+            options.max_threads =
+                std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--precision") == 0 && i + 1 < argc &&
+                   (std::strcmp(argv[i + 1], "float") == 0 ||
+                    std::strcmp(argv[i + 1], "double") == 0)) {
+            options.single = std::strcmp(argv[++i], "float") == 0;
+            options.double_precision = !options.single;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--min-time SECONDS] [--max-spheres N]"
+                         " [--max-threads N] [--precision float|double]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    Report report{};
+
+    if (options.double_precision)
+        bench<double>(report, options, "double");
+    if (options.single)
+        bench<float>(report, options, "float");
+
+    report.print(std::cout, options);
+
+    return 0;
+}
@@ -0,0 +1,683 @@
+#ifndef MINIRAY_BVH_HPP
+#define MINIRAY_BVH_HPP
+
+/*
+ * Bounding volume hierarchy over axis aligned boxes, built with binned SAH.
+ * The tree only knows about boxes: callers pass the primitive bounds in, get
+ * back the order the primitives should be stored in, and supply a leaf
+ * callback when traversing. Nodes are kept in a flat depth-first array where
+ * the left child of an interior node always directly follows its parent.
+ * Large trees can be built with a thread pool.
+ *
+ * When primitives move, the tree can be refitted instead of rebuilt: the
+ * topology is kept and only the bounds change. That is always correct but
+ * the tree gets worse as primitives drift from where it was built for, which
+ * sah_cost() measures.
+ */
+#include "simd.hpp"
+#include "stats.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+template <typename T> struct Aabb {
+    Vec3<T> min{std::numeric_limits<T>::infinity()};
+    Vec3<T> max{-std::numeric_limits<T>::infinity()};
+
+    void grow(const Vec3<T> &p) {
+        min = Vec3<T>{std::min(min.x, p.x), std::min(min.y, p.y),
+                      std::min(min.z, p.z)};
+        max = Vec3<T>{std::max(max.x, p.x), std::max(max.y, p.y),
+                      std::max(max.z, p.z)};
+    }
+
+    void grow(const Aabb &b) {
+        grow(b.min);
+        grow(b.max);
+    }
+
+    Vec3<T> centre() const { return (min + max) * static_cast<T>(0.5); }
+
+    T surface_area() const {
+        if (min.x > max.x)
+            return 0;
+
+        Vec3<T> e{max - min};
+
+        return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // Slab test against the ray segment [0, t_max]. inv_dir must not contain
+    // infinities (see Bvh::inverse) so that no NaN can reach the comparisons.
+    bool hit(const Vec3<T> &ray_orig, const Vec3<T> &inv_dir, T t_max) const {
+        T t_enter{0}, t_exit{t_max};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            T t0{(component(min, axis) - component(ray_orig, axis)) *
+                      component(inv_dir, axis)};
+            T t1{(component(max, axis) - component(ray_orig, axis)) *
+                      component(inv_dir, axis)};
+
+            if (t0 > t1)
+                std::swap(t0, t1);
+
+            t_enter = std::max(t_enter, t0);
+            t_exit = std::min(t_exit, t1);
+        }
+
+        return t_enter <= t_exit;
+    }
+
+    static T component(const Vec3<T> &v, int axis) {
+        return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+    }
+};
+
+template <typename T> struct BvhNode {
+    Aabb<T> bounds{};
+    std::uint32_t offset{}; // First primitive for leaves, right child else
+    std::uint32_t count{};  // Primitive count, 0 for interior nodes
+    std::uint32_t axis{};   // Split axis, used to order child visits
+};
+
+template <typename T> class Bvh {
+  public:
+    static constexpr int BIN_COUNT{16};
+    static constexpr std::uint32_t MAX_LEAF_SIZE{8};
+    // Primitives tested together by one leaf kernel call (SphereSet::LANES)
+    static constexpr std::uint32_t LEAF_BLOCK{SIMD_LANES<T>};
+    // Past this depth SAH splits give way to median splits, which bounds the
+    // tree depth (and the traversal stack) for pathological inputs
+    static constexpr int MAX_SAH_DEPTH{64};
+    static constexpr int STACK_SIZE{128};
+    // Parallel builds pass over large ranges in chunks of this many
+    // primitives, and leave ranges to tasks once there are this many of
+    // them per thread
+    static constexpr std::uint32_t CHUNK{std::uint32_t{1} << 14};
+    static constexpr std::uint32_t TASKS_PER_THREAD{8};
+    // Smaller builds do not gain from a pool
+    static constexpr std::size_t PARALLEL_MIN{std::size_t{1} << 16};
+
+    Bvh() = default;
+
+    // Build over the given primitive bounds. After construction order()[i]
+    // is the index of the primitive that must be stored at position i.
+    // Given a pool of more than one thread, large builds run in parallel and
+    // produce the same tree.
+    explicit Bvh(const std::vector<Aabb<T>> &bounds,
+                 ThreadPool *pool = nullptr) {
+        auto &order{m_order.owned()};
+        order.resize(bounds.size());
+        std::iota(order.begin(), order.end(), 0u);
+
+        if (bounds.empty())
+            return;
+
+        if (pool && pool->size() > 1 && bounds.size() >= PARALLEL_MIN)
+            build_parallel(bounds, *pool);
+        else
+            build_serial(bounds);
+    }
+
+    // A tree built earlier, e.g. borrowed from a scene file
+    Bvh(Storage<BvhNode<T>> nodes, Storage<std::uint32_t> order)
+        : m_nodes{std::move(nodes)}, m_order{std::move(order)} {}
+
+    const Storage<BvhNode<T>> &nodes() const { return m_nodes; }
+    const Storage<std::uint32_t> &order() const { return m_order; }
+
+    // Recompute every node's bounds from new primitive bounds, indexed like
+    // those given to the constructor. Children come after their parent in
+    // the array, so one pass from the back sees every child before its
+    // parent. Must not be called on a borrowed tree.
+    void refit(const std::vector<Aabb<T>> &bounds) {
+        auto &nodes{m_nodes.owned()};
+
+        for (std::size_t i = nodes.size(); i-- > 0;) {
+            auto &node{nodes[i]};
+            Aabb<T> node_bounds{};
+
+            if (node.count > 0) {
+                for (auto j = node.offset; j < node.offset + node.count; ++j)
+                    node_bounds.grow(bounds[m_order[j]]);
+            } else {
+                node_bounds.grow(nodes[i + 1].bounds);
+                node_bounds.grow(nodes[node.offset].bounds);
+            }
+
+            node.bounds = node_bounds;
+        }
+    }
+
+    // Expected cost of a ray through the root under the cost model of the
+    // build: each node costs one box test and each leaf its blocks of
+    // primitives, weighted by the share of the root's surface area the node
+    // covers
+    double sah_cost() const {
+        if (m_nodes.empty() || !(m_nodes[0].bounds.surface_area() > 0))
+            return 0;
+
+        const double root{m_nodes[0].bounds.surface_area()};
+        double cost{0};
+
+        for (const auto &node : m_nodes) {
+            const double share{node.bounds.surface_area() / root};
+
+            cost += share * (1 + (node.count > 0 ? blocks(node.count) : 0));
+        }
+
+        return cost;
+    }
+
+    // Reciprocal direction with zero components clamped to a huge finite
+    // value, which keeps the slab test free of inf * 0.
+    static Vec3<T> inverse(const Vec3<T> &dir) {
+        auto inv = [](T d) {
+            T r{1 / d};
+
+            return std::isfinite(r)
+                       ? r
+                       : std::copysign(std::numeric_limits<T>::max(), d);
+        };
+
+        return Vec3<T>{inv(dir.x), inv(dir.y), inv(dir.z)};
+    }
+
+    // Front to back traversal for closest hit queries, starting at node root.
+    // leaf(first, count, t_max) tests a primitive range and may shrink t_max.
+    template <typename Leaf>
+    void closest(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir, T &t_max,
+                 Leaf &&leaf, std::uint32_t root = 0) const {
+        if (m_nodes.empty())
+            return;
+
+        const Vec3<T> inv_dir{inverse(ray_dir)};
+        const bool negative[3]{ray_dir.x < 0, ray_dir.y < 0, ray_dir.z < 0};
+
+        std::array<std::uint32_t, STACK_SIZE> stack{};
+        int size{0};
+        std::uint32_t index{root};
+
+        while (true) {
+            const auto &node{m_nodes[index]};
+
+            MINIRAY_COUNT(box_tests, 1);
+
+            if (node.bounds.hit(ray_orig, inv_dir, t_max)) {
+                if (node.count > 0) {
+                    leaf(node.offset, node.count, t_max);
+                } else {
+                    // Visit the child on the near side of the split first
+                    std::uint32_t near{index + 1}, far{node.offset};
+
+                    if (negative[node.axis])
+                        std::swap(near, far);
+
+                    stack[size++] = far;
+                    index = near;
+
+                    continue;
+                }
+            }
+
+            if (size == 0)
+                return;
+
+            index = stack[--size];
+        }
+    }
+
+    // Early exit traversal for any hit queries. leaf(first, count) returns
+    // true as soon as something in the range is hit.
+    template <typename Leaf>
+    bool any(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+             Leaf &&leaf) const {
+        if (m_nodes.empty())
+            return false;
+
+        const Vec3<T> inv_dir{inverse(ray_dir)};
+
+        std::array<std::uint32_t, STACK_SIZE> stack{};
+        int size{0};
+        std::uint32_t index{0};
+
+        while (true) {
+            const auto &node{m_nodes[index]};
+
+            MINIRAY_COUNT(box_tests, 1);
+
+            if (node.bounds.hit(ray_orig, inv_dir,
+                                std::numeric_limits<T>::infinity())) {
+                if (node.count > 0) {
+                    if (leaf(node.offset, node.count))
+                        return true;
+                } else {
+                    stack[size++] = node.offset;
+                    index = index + 1;
+
+                    continue;
+                }
+            }
+
+            if (size == 0)
+                return false;
+
+            index = stack[--size];
+        }
+    }
+
+  private:
+    Storage<BvhNode<T>> m_nodes{};
+    Storage<std::uint32_t> m_order{};
+
+    struct Bin {
+        Aabb<T> bounds{};
+        std::uint32_t count{};
+    };
+
+    using Bins = std::array<std::array<Bin, BIN_COUNT>, 3>; // Per axis
+
+    // Bounds of a range of primitives and of their centroids
+    struct Extent {
+        Aabb<T> bounds{}, centroids{};
+    };
+
+    struct Split {
+        int axis{-1}; // -1 when no SAH split was found
+        int bin{0};   // First bin of the right half
+        double cost{INF};
+    };
+
+    // The top of a tree built with a pool: a node split on the calling
+    // thread, or a subtree left to the task tasks[task]
+    struct TopNode {
+        BvhNode<T> node{};
+        std::uint32_t left{}, right{};
+        int task{-1};
+    };
+
+    struct Task {
+        std::uint32_t first{}, count{};
+        int depth{};
+        // Where the built nodes are: arenas[arena][begin, end)
+        unsigned int arena{};
+        std::size_t begin{}, end{};
+    };
+
+    void build_serial(const std::vector<Aabb<T>> &bounds) {
+        std::vector<Vec3<T>> centroids{};
+        centroids.reserve(bounds.size());
+
+        for (const auto &b : bounds)
+            centroids.push_back(b.centre());
+
+        auto &nodes{m_nodes.owned()};
+        nodes.reserve(2 * bounds.size());
+        build(nodes, bounds, centroids, 0,
+              static_cast<std::uint32_t>(bounds.size()), 0);
+    }
+
+    // The top of the tree is split here, spreading the passes over large
+    // ranges across the pool, until the ranges left are small enough that
+    // there are several per thread. Those are built by independent tasks
+    // into a node arena per thread and finally copied into depth-first
+    // order. Splits are made exactly as build() makes them, so the tree is
+    // the one a serial build gives.
+    void build_parallel(const std::vector<Aabb<T>> &bounds, ThreadPool &pool) {
+        const auto total{static_cast<std::uint32_t>(bounds.size())};
+        std::vector<Vec3<T>> centroids(bounds.size());
+
+        for_chunks(pool, 0, total,
+                   [&](std::uint32_t, std::uint32_t first,
+                       std::uint32_t last) {
+                       for (auto i = first; i < last; ++i)
+                           centroids[i] = bounds[i].centre();
+                   });
+
+        const std::uint32_t task_size{
+            std::max(CHUNK, total / (TASKS_PER_THREAD * pool.size()))};
+        std::vector<TopNode> top{};
+        std::vector<Task> tasks{};
+
+        split_top(top, tasks, pool, bounds, centroids, 0, total, 0,
+                  task_size);
+
+        std::vector<std::vector<BvhNode<T>>> arenas(pool.size());
+
+        pool.parallel_for(tasks.size(), [&](std::size_t i) {
+            auto &task{tasks[i]};
+            task.arena = pool.thread_index();
+
+            auto &arena{arenas[task.arena]};
+            task.begin = arena.size();
+            build(arena, bounds, centroids, task.first, task.count,
+                  task.depth);
+            task.end = arena.size();
+        });
+
+        std::size_t size{top.size()};
+
+        for (const auto &arena : arenas)
+            size += arena.size();
+
+        m_nodes.owned().reserve(size);
+        emit(top, tasks, arenas, 0);
+    }
+
+    std::uint32_t split_top(std::vector<TopNode> &top,
+                            std::vector<Task> &tasks, ThreadPool &pool,
+                            const std::vector<Aabb<T>> &bounds,
+                            const std::vector<Vec3<T>> &centroids,
+                            std::uint32_t first, std::uint32_t count,
+                            int depth, std::uint32_t task_size) {
+        const auto index{static_cast<std::uint32_t>(top.size())};
+        top.emplace_back();
+
+        if (count <= task_size) {
+            top[index].task = static_cast<int>(tasks.size());
+            tasks.push_back(Task{first, count, depth});
+
+            return index;
+        }
+
+        // Per chunk extents and bins, merged in chunk order
+        const auto chunks{(count + CHUNK - 1) / CHUNK};
+        std::vector<Extent> extents(chunks);
+
+        for_chunks(pool, first, count,
+                   [&](std::uint32_t chunk, std::uint32_t begin,
+                       std::uint32_t end) {
+                       extents[chunk] = measure(bounds, centroids, begin,
+                                                end - begin);
+                   });
+
+        Extent extent{};
+
+        for (const auto &e : extents) {
+            extent.bounds.grow(e.bounds);
+            extent.centroids.grow(e.centroids);
+        }
+
+        Split split{};
+
+        if (depth < MAX_SAH_DEPTH) {
+            std::vector<Bins> bins(chunks);
+
+            for_chunks(pool, first, count,
+                       [&](std::uint32_t chunk, std::uint32_t begin,
+                           std::uint32_t end) {
+                           bin(bounds, centroids, begin, end - begin,
+                               extent.centroids, bins[chunk]);
+                       });
+
+            for (std::uint32_t c = 1; c < chunks; ++c) {
+                for (int axis = 0; axis < 3; ++axis) {
+                    for (int b = 0; b < BIN_COUNT; ++b) {
+                        bins[0][axis][b].bounds.grow(bins[c][axis][b].bounds);
+                        bins[0][axis][b].count += bins[c][axis][b].count;
+                    }
+                }
+            }
+
+            split = best_split(bins[0], count);
+        }
+
+        // Ranges this large always split
+        const auto middle{partition(centroids, first, count,
+                                    extent.centroids, split)};
+
+        top[index].node.bounds = extent.bounds;
+        top[index].node.axis = static_cast<std::uint32_t>(split.axis);
+
+        const auto left{split_top(top, tasks, pool, bounds, centroids, first,
+                                  middle - first, depth + 1, task_size)};
+        const auto right{split_top(top, tasks, pool, bounds, centroids,
+                                   middle, first + count - middle, depth + 1,
+                                   task_size)};
+
+        top[index].left = left;
+        top[index].right = right;
+
+        return index;
+    }
+
+    // Append the subtree of top[index] to the nodes in depth-first order,
+    // moving the right child links of task nodes to their new positions
+    void emit(const std::vector<TopNode> &top, const std::vector<Task> &tasks,
+              const std::vector<std::vector<BvhNode<T>>> &arenas,
+              std::uint32_t index) {
+        auto &nodes{m_nodes.owned()};
+        const auto &t{top[index]};
+
+        if (t.task >= 0) {
+            const auto &task{tasks[static_cast<std::size_t>(t.task)]};
+            const auto &arena{arenas[task.arena]};
+            const auto base{static_cast<std::uint32_t>(nodes.size())};
+
+            for (auto i = task.begin; i < task.end; ++i) {
+                auto node{arena[i]};
+
+                if (node.count == 0)
+                    node.offset = static_cast<std::uint32_t>(
+                        node.offset - task.begin + base);
+
+                nodes.push_back(node);
+            }
+
+            return;
+        }
+
+        const auto at{nodes.size()};
+        nodes.push_back(t.node);
+        emit(top, tasks, arenas, t.left);
+        nodes[at].offset = static_cast<std::uint32_t>(nodes.size());
+        emit(top, tasks, arenas, t.right);
+    }
+
+    // f(chunk, begin, end) for consecutive chunks of [first, first + count)
+    template <typename F>
+    static void for_chunks(ThreadPool &pool, std::uint32_t first,
+                           std::uint32_t count, F &&f) {
+        const auto chunks{(count + CHUNK - 1) / CHUNK};
+
+        pool.parallel_for(chunks, [&](std::size_t chunk) {
+            const auto begin{
+                first + static_cast<std::uint32_t>(chunk) * CHUNK};
+
+            f(static_cast<std::uint32_t>(chunk), begin,
+              std::min(begin + CHUNK, first + count));
+        });
+    }
+
+    Extent measure(const std::vector<Aabb<T>> &bounds,
+                   const std::vector<Vec3<T>> &centroids, std::uint32_t first,
+                   std::uint32_t count) const {
+        const auto *order{m_order.data()};
+        Extent extent{};
+
+        for (std::uint32_t i = first; i < first + count; ++i) {
+            extent.bounds.grow(bounds[order[i]]);
+            extent.centroids.grow(centroids[order[i]]);
+        }
+
+        return extent;
+    }
+
+    // Bin a range along each axis over which the centroids spread
+    void bin(const std::vector<Aabb<T>> &bounds,
+             const std::vector<Vec3<T>> &centroids, std::uint32_t first,
+             std::uint32_t count, const Aabb<T> &centroid_bounds,
+             Bins &bins) const {
+        const auto *order{m_order.data()};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const T lo{Aabb<T>::component(centroid_bounds.min, axis)};
+            const T extent{Aabb<T>::component(centroid_bounds.max, axis) - lo};
+
+            if (extent <= 0)
+                continue;
+
+            for (std::uint32_t i = first; i < first + count; ++i) {
+                auto &bin{bins[axis][bin_index(centroids[order[i]], axis, lo,
+                                               extent)]};
+                bin.bounds.grow(bounds[order[i]]);
+                ++bin.count;
+            }
+        }
+    }
+
+    // The cheapest binned SAH split over all three axes
+    static Split best_split(const Bins &bins, std::uint32_t count) {
+        Split best{};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            // Sweep from the right to get the cost of every right half
+            std::array<double, BIN_COUNT> right_cost{};
+            Aabb<T> right{};
+            std::uint32_t right_count{0};
+
+            for (int b = BIN_COUNT - 1; b > 0; --b) {
+                right.grow(bins[axis][b].bounds);
+                right_count += bins[axis][b].count;
+                right_cost[b] = static_cast<double>(right.surface_area()) *
+                                blocks(right_count);
+            }
+
+            Aabb<T> left{};
+            std::uint32_t left_count{0};
+
+            for (int b = 0; b < BIN_COUNT - 1; ++b) {
+                left.grow(bins[axis][b].bounds);
+                left_count += bins[axis][b].count;
+
+                double cost{static_cast<double>(left.surface_area()) *
+                                blocks(left_count) +
+                            right_cost[b + 1]};
+
+                if (left_count > 0 && left_count < count && cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = b + 1;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    // Split order[first, first + count) in two and return where the right
+    // half starts. Without an SAH split the range is cut at the object
+    // median of the widest centroid axis, which becomes split.axis.
+    std::uint32_t partition(const std::vector<Vec3<T>> &centroids,
+                            std::uint32_t first, std::uint32_t count,
+                            const Aabb<T> &centroid_bounds, Split &split) {
+        auto &order{m_order.owned()};
+
+        if (split.axis >= 0) {
+            const int axis{split.axis};
+            const T lo{Aabb<T>::component(centroid_bounds.min, axis)};
+            const T extent{Aabb<T>::component(centroid_bounds.max, axis) - lo};
+
+            auto *middle = std::partition(
+                order.data() + first, order.data() + first + count,
+                [&](std::uint32_t prim) {
+                    return bin_index(centroids[prim], axis, lo, extent) <
+                           split.bin;
+                });
+
+            return static_cast<std::uint32_t>(middle - order.data());
+        }
+
+        const std::uint32_t middle{first + count / 2};
+        const Vec3<T> extent{centroid_bounds.max - centroid_bounds.min};
+        const int axis{extent.x >= extent.y && extent.x >= extent.z ? 0
+                       : extent.y >= extent.z                      ? 1
+                                                                   : 2};
+
+        std::nth_element(order.data() + first, order.data() + middle,
+                         order.data() + first + count,
+                         [&](std::uint32_t a, std::uint32_t b) {
+                             return Aabb<T>::component(centroids[a], axis) <
+                                    Aabb<T>::component(centroids[b], axis);
+                         });
+        split.axis = axis;
+
+        return middle;
+    }
+
+    // Recursively build the subtree for order[first, first + count),
+    // appending its nodes depth first, and return its node index.
+    std::uint32_t build(std::vector<BvhNode<T>> &nodes,
+                        const std::vector<Aabb<T>> &bounds,
+                        const std::vector<Vec3<T>> &centroids,
+                        std::uint32_t first, std::uint32_t count, int depth) {
+        const auto index{static_cast<std::uint32_t>(nodes.size())};
+        nodes.emplace_back();
+
+        const Extent extent{measure(bounds, centroids, first, count)};
+        nodes[index].bounds = extent.bounds;
+
+        Split split{};
+
+        if (count > 1 && depth < MAX_SAH_DEPTH) {
+            Bins bins{};
+            bin(bounds, centroids, first, count, extent.centroids, bins);
+            split = best_split(bins, count);
+        }
+
+        // Traversal costs about as much as one intersection test
+        const double area{extent.bounds.surface_area()};
+        const double leaf_cost{blocks(count)};
+        const double split_cost{area > 0 ? 1 + split.cost / area : INF};
+
+        if (count <= MAX_LEAF_SIZE &&
+            (split.axis < 0 || split_cost >= leaf_cost)) {
+            nodes[index].offset = first;
+            nodes[index].count = count;
+
+            return index;
+        }
+
+        const auto middle{
+            partition(centroids, first, count, extent.centroids, split)};
+
+        nodes[index].axis = static_cast<std::uint32_t>(split.axis);
+
+        build(nodes, bounds, centroids, first, middle - first, depth + 1);
+        const auto right_child{build(nodes, bounds, centroids, middle,
+                                     first + count - middle, depth + 1)};
+
+        nodes[index].offset = right_child;
+
+        return index;
+    }
+
+    // Leaves are intersected LEAF_BLOCK primitives at a time, so a leaf
+    // costs as much as the number of blocks it needs
+    static double blocks(std::uint32_t count) {
+        return static_cast<double>((count + LEAF_BLOCK - 1) / LEAF_BLOCK);
+    }
+
+    static int bin_index(const Vec3<T> &centroid, int axis, T lo, T extent) {
+        auto bin{static_cast<int>((Aabb<T>::component(centroid, axis) - lo) /
+                                  extent * BIN_COUNT)};
+
+        return std::clamp(bin, 0, BIN_COUNT - 1);
+    }
+};
+
+} // namespace mini_ray
+
+#endif
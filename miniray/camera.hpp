@@ -0,0 +1,60 @@
+#ifndef MINIRAY_CAMERA_HPP
+#define MINIRAY_CAMERA_HPP
+
+/*
+ * Pinhole camera at the origin looking down -z. The image plane is set up in
+ * double and each direction is rounded to the render precision once.
+ */
+#include "random.hpp"
+#include "shading.hpp"
+#include "vec3.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+namespace mini_ray {
+
+template <typename T> class Camera {
+  public:
+    Camera(int width, int height, int fov = 30)
+        : m_inv_width{1 / static_cast<double>(width)},
+          m_inv_height{1 / static_cast<double>(height)},
+          m_aspect_ratio{width / static_cast<double>(height)},
+          m_look_angle{tan(PI * 0.5 * fov / 180.)} {}
+
+    // Direction through the point (x + sx, y + sy) of the image, where
+    // (0.5, 0.5) is the centre of pixel (x, y)
+    Vec3<T> ray(int x, int y, double sx = 0.5, double sy = 0.5) const {
+        double xx{(2 * ((x + sx) * m_inv_width) - 1) * m_look_angle *
+                  m_aspect_ratio};
+        double yy{(1 - 2 * ((y + sy) * m_inv_height)) * m_look_angle};
+
+        Vec3<T> ray_dir{static_cast<T>(xx), static_cast<T>(yy), -1};
+        ray_dir.normalise();
+
+        return ray_dir;
+    }
+
+  private:
+    double m_inv_width, m_inv_height;
+    double m_aspect_ratio, m_look_angle;
+};
+
+// Position of a sample inside pixel (x, y) for Camera::ray: the centre for
+// sample 0, then a point drawn from the pixel's random stream for that
+// sample, so every engine and thread count sees the same samples
+inline std::pair<double, double> sample_position(int x, int y, int sample) {
+    if (sample == 0)
+        return {0.5, 0.5};
+
+    Rng rng{static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y),
+            static_cast<std::uint32_t>(sample)};
+    const double sx{rng.uniform()};
+
+    return {sx, rng.uniform()};
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,426 @@
+#ifndef MINIRAY_DENOISE_HPP
+#define MINIRAY_DENOISE_HPP
+
+/*
+ * Edge-avoiding à-trous wavelet denoiser (Dammertz et al., "Edge-Avoiding
+ * À-Trous Wavelet Transform for fast Global Illumination Filtering", HPG
+ * 2010) for renders with few samples per pixel.
+ *
+ * Each iteration blurs the frame with a 5x5 B3 spline kernel whose taps are
+ * spread 2^i pixels apart, so a few iterations cover a wide footprint at 25
+ * taps per pixel each. Every tap is weighted down by how much it differs from
+ * the centre pixel in colour and in the guide buffers: the normal, depth and
+ * albedo of the first hit along each pixel's centre ray. Noise is averaged
+ * away within a surface while the edges between surfaces stay sharp. The
+ * colour tolerance halves every iteration, as in the paper.
+ *
+ * The filter works on float planes. Rows are spread over a thread pool, and
+ * inside a row eight pixels are filtered per AVX2 register where all of
+ * their taps fall inside the image.
+ */
+#include "camera.hpp"
+#include "image.hpp"
+#include "scene.hpp"
+#include "shading.hpp"
+#include "simd.hpp"
+#include "sphere.hpp"
+#include "thread_pool.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace mini_ray {
+
+struct DenoiseOptions {
+    // Tap spacing doubles each time, up to 2^(n-1) or the image size
+    int iterations{5};
+    // Differences at which a tap's weight falls to 1/e
+    float sigma_colour{0.6f}; // Linear colour, for the first iteration
+    float sigma_normal{0.3f};
+    float sigma_depth{0.05f}; // Relative distance to the first hit
+    float sigma_albedo{0.1f};
+    unsigned int threads{0}; // 0 uses every hardware thread
+};
+
+// Features of the first hit along each pixel's centre ray, row major
+struct GuideBuffers {
+    // Depth of rays that hit nothing, far beyond any log distance a scene
+    // produces
+    static constexpr float MISS_DEPTH{1e4f};
+
+    int width{}, height{};
+    std::vector<float> normal_x{}, normal_y{}, normal_z{};
+    std::vector<float> depth{}; // Log of the distance to the hit
+    std::vector<float> albedo_r{}, albedo_g{}, albedo_b{};
+
+    GuideBuffers() = default;
+
+    GuideBuffers(int width, int height)
+        : width{width}, height{height},
+          normal_x(static_cast<std::size_t>(width) * height),
+          normal_y(normal_x.size()), normal_z(normal_x.size()),
+          depth(normal_x.size()), albedo_r(normal_x.size()),
+          albedo_g(normal_x.size()), albedo_b(normal_x.size()) {}
+
+    // The buffers as viewable images: normals mapped from [-1, 1] to
+    // [0, 1], depth from near (white) to far (black) over the frame
+    Image<float> normal_image() const {
+        Image<float> image{width, height};
+
+        for (std::size_t i = 0; i < depth.size(); ++i)
+            image.pixels[i] =
+                Vec3<float>{normal_x[i], normal_y[i], normal_z[i]} * 0.5f +
+                Vec3<float>{0.5f};
+
+        return image;
+    }
+
+    Image<float> depth_image() const {
+        Image<float> image{width, height};
+        float near{std::numeric_limits<float>::infinity()}, far{-near};
+
+        for (float d : depth) {
+            if (d != MISS_DEPTH) {
+                near = std::min(near, d);
+                far = std::max(far, d);
+            }
+        }
+
+        for (std::size_t i = 0; i < depth.size(); ++i) {
+            if (depth[i] != MISS_DEPTH)
+                image.pixels[i] = Vec3<float>{
+                    far > near ? (far - depth[i]) / (far - near) : 1.0f};
+        }
+
+        return image;
+    }
+
+    Image<float> albedo_image() const {
+        Image<float> image{width, height};
+
+        for (std::size_t i = 0; i < depth.size(); ++i)
+            image.pixels[i] = Vec3<float>{albedo_r[i], albedo_g[i],
+                                          albedo_b[i]};
+
+        return image;
+    }
+};
+
+// Fill the guide buffers of a frame with the camera of the tile renderer.
+// Rays that miss see the background as their albedo.
+template <typename T>
+GuideBuffers render_guides(const Scene<T> &scene, int width, int height,
+                           unsigned int threads = 0) {
+    GuideBuffers guides{width, height};
+    const Camera<T> camera{width, height};
+    ThreadPool pool{threads};
+
+    pool.parallel_for(static_cast<std::size_t>(height), [&](std::size_t y) {
+        for (int x = 0; x < width; ++x) {
+            const auto i{y * width + x};
+            const auto ray_dir{camera.ray(x, static_cast<int>(y))};
+            Hit<T> hit{};
+            Vec3<T> normal{}, albedo{BACKGROUND_COLOUR<T>};
+            float depth{GuideBuffers::MISS_DEPTH};
+
+            if (scene.closest_hit(Vec3<T>{}, ray_dir, hit)) {
+                const auto surface{surface_hit(Vec3<T>{}, ray_dir, scene, hit)};
+
+                normal = surface.n_hit;
+                albedo = surface.sphere.surface_colour +
+                         surface.sphere.emission_colour;
+                depth = std::log(std::max(static_cast<float>(hit.t), 1e-6f));
+            }
+
+            guides.normal_x[i] = static_cast<float>(normal.x);
+            guides.normal_y[i] = static_cast<float>(normal.y);
+            guides.normal_z[i] = static_cast<float>(normal.z);
+            guides.depth[i] = depth;
+            guides.albedo_r[i] = static_cast<float>(albedo.x);
+            guides.albedo_g[i] = static_cast<float>(albedo.y);
+            guides.albedo_b[i] = static_cast<float>(albedo.z);
+        }
+    });
+
+    return guides;
+}
+
+template <typename T>
+GuideBuffers render_guides(const std::vector<Sphere<T>> &spheres, int width,
+                           int height, unsigned int threads = 0) {
+    return render_guides(Scene<T>{spheres, Accelerator::automatic, threads},
+                         width, height, threads);
+}
+
+namespace denoise_detail {
+
+// B3 spline taps
+constexpr float KERNEL[5]{1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+// exp(-x) for x >= 0, to about 1e-4 relative. Exactly the same arithmetic
+// as the AVX2 version, so both paths filter alike.
+inline float exp_negative(float x) {
+    const float y{-std::min(x, 80.0f) * 1.44269504f};
+    const float n{std::floor(y)};
+    const float f{y - n};
+    float p{0.00133336f};
+
+    p = p * f + 0.00961813f;
+    p = p * f + 0.0555041f;
+    p = p * f + 0.240227f;
+    p = p * f + 0.693147f;
+    p = p * f + 1.0f;
+
+    const auto bits{static_cast<std::uint32_t>(static_cast<int>(n) + 127)
+                    << 23};
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+
+    return p * scale;
+}
+
+// The colour planes and guides one iteration reads
+struct Planes {
+    const float *r, *g, *b;
+    const GuideBuffers *guides;
+    int width, height;
+    // 1 / sigma^2 of each feature
+    float colour, normal, depth, albedo;
+};
+
+inline void filter_pixel(const Planes &in, int step, int x, int y, float *r,
+                         float *g, float *b) {
+    const auto &guides{*in.guides};
+    const std::size_t p{static_cast<std::size_t>(y) * in.width + x};
+    float sum_w{0}, sum_r{0}, sum_g{0}, sum_b{0};
+
+    for (int ky = 0; ky < 5; ++ky) {
+        const int qy{y + (ky - 2) * step};
+
+        if (qy < 0 || qy >= in.height)
+            continue;
+
+        for (int kx = 0; kx < 5; ++kx) {
+            const int qx{x + (kx - 2) * step};
+
+            if (qx < 0 || qx >= in.width)
+                continue;
+
+            const std::size_t q{static_cast<std::size_t>(qy) * in.width + qx};
+            const auto square = [](float a) { return a * a; };
+
+            const float colour{square(in.r[q] - in.r[p]) +
+                               square(in.g[q] - in.g[p]) +
+                               square(in.b[q] - in.b[p])};
+            const float normal{square(guides.normal_x[q] - guides.normal_x[p]) +
+                               square(guides.normal_y[q] - guides.normal_y[p]) +
+                               square(guides.normal_z[q] - guides.normal_z[p])};
+            const float depth{square(guides.depth[q] - guides.depth[p])};
+            const float albedo{square(guides.albedo_r[q] - guides.albedo_r[p]) +
+                               square(guides.albedo_g[q] - guides.albedo_g[p]) +
+                               square(guides.albedo_b[q] - guides.albedo_b[p])};
+            const float w{KERNEL[kx] * KERNEL[ky] *
+                          exp_negative(colour * in.colour +
+                                       normal * in.normal + depth * in.depth +
+                                       albedo * in.albedo)};
+
+            sum_w += w;
+            sum_r += w * in.r[q];
+            sum_g += w * in.g[q];
+            sum_b += w * in.b[q];
+        }
+    }
+
+    // The centre tap always has weight 1 / 64 or more
+    r[p] = sum_r / sum_w;
+    g[p] = sum_g / sum_w;
+    b[p] = sum_b / sum_w;
+}
+
+#ifdef MINIRAY_AVX2_KERNEL
+__attribute__((target("avx2"))) inline __m256 exp_negative_avx2(__m256 x) {
+    const __m256 y{_mm256_mul_ps(
+        _mm256_sub_ps(_mm256_setzero_ps(),
+                      _mm256_min_ps(x, _mm256_set1_ps(80.0f))),
+        _mm256_set1_ps(1.44269504f))};
+    const __m256 n{_mm256_floor_ps(y)};
+    const __m256 f{_mm256_sub_ps(y, n)};
+    __m256 p{_mm256_set1_ps(0.00133336f)};
+
+    for (float c : {0.00961813f, 0.0555041f, 0.240227f, 0.693147f, 1.0f})
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(c));
+
+    const __m256i bits{_mm256_slli_epi32(
+        _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23)};
+
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+// Squared difference of plane[q, q + 8) from centre
+__attribute__((target("avx2"))) inline __m256
+difference_avx2(const float *plane, std::size_t q, __m256 centre) {
+    using V = Avx2<float>;
+    const __m256 d{V::sub(V::loadu(plane + q), centre)};
+
+    return V::mul(d, d);
+}
+
+// Pixels [x, x + 8) of row y, all of whose taps lie inside the row
+__attribute__((target("avx2"))) inline void
+filter_block_avx2(const Planes &in, int step, int x, int y, float *r,
+                  float *g, float *b) {
+    using V = Avx2<float>;
+    const auto &guides{*in.guides};
+    const std::size_t p{static_cast<std::size_t>(y) * in.width + x};
+
+    const __m256 pr{V::loadu(in.r + p)}, pg{V::loadu(in.g + p)},
+        pb{V::loadu(in.b + p)};
+    const __m256 pnx{V::loadu(guides.normal_x.data() + p)};
+    const __m256 pny{V::loadu(guides.normal_y.data() + p)};
+    const __m256 pnz{V::loadu(guides.normal_z.data() + p)};
+    const __m256 pd{V::loadu(guides.depth.data() + p)};
+    const __m256 par{V::loadu(guides.albedo_r.data() + p)};
+    const __m256 pag{V::loadu(guides.albedo_g.data() + p)};
+    const __m256 pab{V::loadu(guides.albedo_b.data() + p)};
+    __m256 sum_w{V::zero()}, sum_r{sum_w}, sum_g{sum_w}, sum_b{sum_w};
+
+    for (int ky = 0; ky < 5; ++ky) {
+        const int qy{y + (ky - 2) * step};
+
+        if (qy < 0 || qy >= in.height)
+            continue;
+
+        for (int kx = 0; kx < 5; ++kx) {
+            const std::size_t q{static_cast<std::size_t>(qy) * in.width + x +
+                                (kx - 2) * step};
+
+            const __m256 colour{
+                V::add(V::add(difference_avx2(in.r, q, pr),
+                              difference_avx2(in.g, q, pg)),
+                       difference_avx2(in.b, q, pb))};
+            const __m256 normal{
+                V::add(V::add(difference_avx2(guides.normal_x.data(), q, pnx),
+                              difference_avx2(guides.normal_y.data(), q, pny)),
+                       difference_avx2(guides.normal_z.data(), q, pnz))};
+            const __m256 depth{difference_avx2(guides.depth.data(), q, pd)};
+            const __m256 albedo{
+                V::add(V::add(difference_avx2(guides.albedo_r.data(), q, par),
+                              difference_avx2(guides.albedo_g.data(), q, pag)),
+                       difference_avx2(guides.albedo_b.data(), q, pab))};
+            const __m256 exponent{V::add(
+                V::add(V::add(V::mul(colour, V::set1(in.colour)),
+                              V::mul(normal, V::set1(in.normal))),
+                       V::mul(depth, V::set1(in.depth))),
+                V::mul(albedo, V::set1(in.albedo)))};
+            const __m256 w{V::mul(V::set1(KERNEL[kx] * KERNEL[ky]),
+                                  exp_negative_avx2(exponent))};
+
+            sum_w = V::add(sum_w, w);
+            sum_r = V::add(sum_r, V::mul(w, V::loadu(in.r + q)));
+            sum_g = V::add(sum_g, V::mul(w, V::loadu(in.g + q)));
+            sum_b = V::add(sum_b, V::mul(w, V::loadu(in.b + q)));
+        }
+    }
+
+    V::storeu(r + p, V::div(sum_r, sum_w));
+    V::storeu(g + p, V::div(sum_g, sum_w));
+    V::storeu(b + p, V::div(sum_b, sum_w));
+}
+#endif
+
+inline void filter_row(const Planes &in, int step, int y, float *r, float *g,
+                       float *b) {
+    int x{0};
+
+#ifdef MINIRAY_AVX2_KERNEL
+    if (avx2_supported()) {
+        const int reach{2 * step};
+
+        for (; x < std::min(reach, in.width); ++x)
+            filter_pixel(in, step, x, y, r, g, b);
+
+        for (; x + 8 + reach <= in.width; x += 8)
+            filter_block_avx2(in, step, x, y, r, g, b);
+    }
+#endif
+    for (; x < in.width; ++x)
+        filter_pixel(in, step, x, y, r, g, b);
+}
+
+} // namespace denoise_detail
+
+// Filter a frame guided by the buffers rendered for it
+template <typename T>
+Image<T> denoise(const Image<T> &image, const GuideBuffers &guides,
+                 const DenoiseOptions &options = {}) {
+    const std::size_t size{image.pixels.size()};
+    std::vector<float> planes[2][3];
+
+    for (auto &buffer : planes) {
+        for (auto &plane : buffer)
+            plane.resize(size);
+    }
+
+    for (std::size_t i = 0; i < size; ++i) {
+        planes[0][0][i] = static_cast<float>(image.pixels[i].x);
+        planes[0][1][i] = static_cast<float>(image.pixels[i].y);
+        planes[0][2][i] = static_cast<float>(image.pixels[i].z);
+    }
+
+    const auto inverse_square = [](float sigma) {
+        return sigma > 0 ? 1 / (sigma * sigma) : 0.0f;
+    };
+    ThreadPool pool{options.threads};
+    float sigma_colour{options.sigma_colour};
+    int current{0};
+    // Once the spacing reaches the size of the image only the centre tap is
+    // left, so further passes change nothing and the spacing would overflow
+    const int extent{std::max(image.width, image.height)};
+
+    for (int i = 0, step = 1; i < options.iterations && step < extent;
+         ++i, step *= 2) {
+        const auto &in{planes[current]};
+        auto &out{planes[1 - current]};
+        const denoise_detail::Planes source{
+            in[0].data(),
+            in[1].data(),
+            in[2].data(),
+            &guides,
+            image.width,
+            image.height,
+            inverse_square(sigma_colour),
+            inverse_square(options.sigma_normal),
+            inverse_square(options.sigma_depth),
+            inverse_square(options.sigma_albedo)};
+
+        pool.parallel_for(static_cast<std::size_t>(image.height),
+                          [&](std::size_t y) {
+                              denoise_detail::filter_row(
+                                  source, step, static_cast<int>(y),
+                                  out[0].data(), out[1].data(),
+                                  out[2].data());
+                          });
+
+        sigma_colour /= 2;
+        current = 1 - current;
+    }
+
+    Image<T> result{image.width, image.height};
+
+    for (std::size_t i = 0; i < size; ++i)
+        result.pixels[i] = Vec3<T>{static_cast<T>(planes[current][0][i]),
+                                   static_cast<T>(planes[current][1][i]),
+                                   static_cast<T>(planes[current][2][i])};
+
+    return result;
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,513 @@
+#ifndef MINIRAY_DISTRIBUTED_HPP
+#define MINIRAY_DISTRIBUTED_HPP
+
+/*
+ * Multi-process rendering on one machine. The coordinator forks worker
+ * processes once the scene is in memory, so every worker starts with the
+ * scene already loaded (shared copy-on-write, or through the same mapping
+ * for scene files), and talks to each over its own Unix socket pair.
+ *
+ * The coordinator keeps every worker busy with a few tiles at a time and
+ * receives finished tiles as they are done, in whatever order they arrive.
+ * A worker that dies or closes its socket has its outstanding tiles handed
+ * to the others. Once no untraced tile is left, tiles a worker has been
+ * sitting on for longer than the timeout are traced a second time by an idle
+ * worker and whichever copy arrives first is kept, so one slow or stuck
+ * process cannot hold up the frame. The coordinator's ends of the sockets
+ * are non-blocking and whatever a worker has sent so far is collected in a
+ * buffer, so a worker that stops halfway through a tile is only late, like
+ * one that stops before it.
+ *
+ * Each worker traces with a single thread, and with MINIRAY_STATS their ray
+ * statistics stay in the worker processes.
+ */
+#include "image.hpp"
+#include "scene.hpp"
+#include "tile_renderer.hpp"
+#include "vec3.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace mini_ray {
+
+struct DistributedOptions {
+    unsigned int workers{0}; // 0 starts one per hardware thread
+    int tiles_in_flight{2};  // Tiles queued at a worker, hides round trips
+    double tile_timeout{10}; // Seconds before a tile is traced again
+};
+
+namespace distributed_detail {
+
+// Read or write exactly size bytes. False on end of file or error.
+inline bool read_all(int fd, void *data, std::size_t size) {
+    auto *p{static_cast<unsigned char *>(data)};
+
+    while (size > 0) {
+        const auto count{::read(fd, p, size)};
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+
+        p += count;
+        size -= static_cast<std::size_t>(count);
+    }
+
+    return true;
+}
+
+// On a non-blocking socket a full buffer is an error too. The coordinator
+// only sends tile numbers, a few at a time, so that needs a stuck worker.
+inline bool write_all(int fd, const void *data, std::size_t size) {
+    const auto *p{static_cast<const unsigned char *>(data)};
+
+    while (size > 0) {
+        // MSG_NOSIGNAL: a dead peer is an error, not SIGPIPE
+        const auto count{::send(fd, p, size, MSG_NOSIGNAL)};
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+
+        p += count;
+        size -= static_cast<std::size_t>(count);
+    }
+
+    return true;
+}
+
+// Sent ahead of the pixels of a finished tile, row by row
+struct TileHeader {
+    std::uint32_t tile{};
+    std::uint32_t pixels{};
+};
+
+} // namespace distributed_detail
+
+template <typename T> class DistributedRenderer {
+  public:
+    // Start the workers. Call before any other threads are started, since
+    // only the forking thread survives in a child.
+    DistributedRenderer(const Scene<T> &scene, const RenderOptions &options,
+                        const DistributedOptions &distributed = {})
+        : m_renderer{scene, single_threaded(options)},
+          m_distributed{distributed} {
+        unsigned int count{distributed.workers};
+
+        if (count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+
+        try {
+            for (unsigned int i = 0; i < count; ++i)
+                start_worker();
+        } catch (...) {
+            stop_workers();
+            throw;
+        }
+    }
+
+    DistributedRenderer(const DistributedRenderer &) = delete;
+    DistributedRenderer &operator=(const DistributedRenderer &) = delete;
+
+    ~DistributedRenderer() { stop_workers(); }
+
+    const RenderOptions &options() const { return m_renderer.options(); }
+    int tile_size() const { return m_renderer.tile_size(); }
+
+    // Trace every pixel once through its centre, like TileRenderer::render,
+    // calling done(tile) as each tile comes back. Throws if every worker
+    // has died.
+    template <typename Store, typename Done>
+    void render(Store &&store, Done &&done) {
+        using Clock = std::chrono::steady_clock;
+
+        const std::size_t tile_count{m_renderer.tile_count()};
+        const auto timeout{std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>{m_distributed.tile_timeout})};
+        std::deque<std::uint32_t> pending(tile_count);
+        std::vector<bool> finished(tile_count);
+        std::vector<int> copies(tile_count); // Workers holding each tile
+        std::size_t remaining{tile_count};
+        std::vector<Vec3<T>> pixels{};
+        std::vector<pollfd> fds{};
+        std::vector<Worker *> polled{};
+
+        for (std::size_t i = 0; i < tile_count; ++i)
+            pending[i] = static_cast<std::uint32_t>(i);
+
+        // After the last tile, wait for the duplicates still out so the
+        // workers are idle for the next frame
+        while (remaining > 0 || busy()) {
+            const auto now{Clock::now()};
+
+            for (auto &worker : m_workers) {
+                if (remaining == 0 && worker.alive &&
+                    overdue(worker, now, timeout))
+                    fail(worker, pending, finished, copies);
+
+                while (worker.alive &&
+                       worker.outstanding.size() <
+                           static_cast<std::size_t>(
+                               std::max(1, m_distributed.tiles_in_flight))) {
+                    const auto tile{
+                        next_tile(pending, finished, copies, now, timeout)};
+
+                    if (tile == NO_TILE)
+                        break;
+
+                    if (!distributed_detail::write_all(worker.fd, &tile,
+                                                       sizeof(tile))) {
+                        fail(worker, pending, finished, copies);
+                        pending.push_front(tile);
+                        break;
+                    }
+
+                    ++copies[tile];
+                    worker.outstanding.push_back(Assignment{tile, now});
+                }
+            }
+
+            fds.clear();
+            polled.clear();
+
+            for (auto &worker : m_workers) {
+                if (worker.alive) {
+                    fds.push_back(pollfd{worker.fd, POLLIN, 0});
+                    polled.push_back(&worker);
+                }
+            }
+
+            if (fds.empty())
+                throw std::runtime_error{"every render worker has died"};
+
+            // Wake up now and then to check for tiles that are overdue
+            if (::poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR)
+                throw std::system_error{errno, std::generic_category(),
+                                        "poll"};
+
+            for (std::size_t i = 0; i < fds.size(); ++i) {
+                if (!fds[i].revents)
+                    continue;
+
+                auto &worker{*polled[i]};
+                const bool open{receive(worker)};
+
+                // Tiles that arrived in full before the end of file count
+                while (worker.alive) {
+                    const auto status{unpack(worker, pixels)};
+
+                    if (status == Inbox::partial)
+                        break;
+
+                    if (status == Inbox::invalid) {
+                        fail(worker, pending, finished, copies);
+                        break;
+                    }
+
+                    const auto tile{worker.outstanding.front().tile};
+                    worker.outstanding.pop_front();
+                    --copies[tile];
+
+                    // The worker starts on its next tile now
+                    if (!worker.outstanding.empty())
+                        worker.outstanding.front().started = Clock::now();
+
+                    if (finished[tile])
+                        continue;
+
+                    const auto region{m_renderer.tile(tile)};
+                    std::size_t k{0};
+
+                    for (int y = region.y0; y < region.y1; ++y) {
+                        for (int x = region.x0; x < region.x1; ++x)
+                            store(x, y, pixels[k++]);
+                    }
+
+                    finished[tile] = true;
+                    --remaining;
+                    done(region);
+                }
+
+                if (worker.alive && !open)
+                    fail(worker, pending, finished, copies);
+            }
+        }
+    }
+
+  private:
+    static constexpr std::uint32_t NO_TILE{0xffffffffu};
+
+    struct Assignment {
+        std::uint32_t tile{};
+        // When the worker got to it: sent for the first tile, when the
+        // previous one came back for the others
+        std::chrono::steady_clock::time_point started{};
+    };
+
+    struct Worker {
+        pid_t pid{-1};
+        int fd{-1};
+        bool alive{true};
+        std::deque<Assignment> outstanding{}; // Answered in this order
+        std::vector<unsigned char> inbox{};   // Received, not yet unpacked
+    };
+
+    enum class Inbox {
+        partial, // The next tile has not fully arrived
+        tile,    // The next tile was unpacked
+        invalid  // The worker sent something it was not asked for
+    };
+
+    TileRenderer<T> m_renderer; // One thread, so no threads to fork
+    DistributedOptions m_distributed;
+    std::vector<Worker> m_workers{};
+
+    static RenderOptions single_threaded(RenderOptions options) {
+        options.threads = 1;
+        options.stats = nullptr;
+
+        return options;
+    }
+
+    void start_worker() {
+        int fds[2];
+
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            throw std::system_error{errno, std::generic_category(),
+                                    "socketpair"};
+
+        const pid_t pid{::fork()};
+
+        if (pid < 0) {
+            const int error{errno};
+            ::close(fds[0]);
+            ::close(fds[1]);
+            throw std::system_error{error, std::generic_category(), "fork"};
+        }
+
+        if (pid == 0) {
+            // The sockets of earlier workers must not be kept open here, or
+            // the coordinator would never see them close
+            for (const auto &worker : m_workers)
+                ::close(worker.fd);
+
+            ::close(fds[0]);
+
+            int status{0};
+
+            try {
+                worker_loop(fds[1]);
+            } catch (...) {
+                status = 1;
+            }
+
+            // Skip the parent's exit handlers and buffered output
+            ::_exit(status);
+        }
+
+        ::close(fds[1]);
+        m_workers.push_back(Worker{pid, fds[0]});
+
+        const int flags{::fcntl(fds[0], F_GETFL)};
+
+        if (flags < 0 || ::fcntl(fds[0], F_SETFL, flags | O_NONBLOCK) < 0)
+            throw std::system_error{errno, std::generic_category(), "fcntl"};
+    }
+
+    // Trace tiles until the coordinator closes the socket
+    void worker_loop(int fd) {
+        const auto &camera{m_renderer.camera()};
+        std::vector<Vec3<T>> pixels{};
+        std::uint32_t index{};
+
+        while (distributed_detail::read_all(fd, &index, sizeof(index))) {
+            const auto tile{m_renderer.tile(index)};
+            const int width{tile.x1 - tile.x0};
+
+            pixels.resize(static_cast<std::size_t>(width) *
+                          (tile.y1 - tile.y0));
+
+            m_renderer.pool().parallel_for(1, [&](std::size_t) {
+                m_renderer.trace(
+                    tile, [](int, int) { return true; },
+                    [&](int x, int y) { return camera.ray(x, y); },
+                    [&](int x, int y, const Vec3<T> &colour) {
+                        pixels[static_cast<std::size_t>(y - tile.y0) * width +
+                               (x - tile.x0)] = colour;
+                    });
+            });
+
+            const distributed_detail::TileHeader header{
+                index, static_cast<std::uint32_t>(pixels.size())};
+
+            if (!distributed_detail::write_all(fd, &header, sizeof(header)) ||
+                !distributed_detail::write_all(
+                    fd, pixels.data(), pixels.size() * sizeof(Vec3<T>)))
+                return;
+        }
+    }
+
+    // Append whatever a worker has sent to its inbox without waiting for
+    // more. False once the worker has closed its socket or on an error.
+    static bool receive(Worker &worker) {
+        unsigned char buffer[1 << 16];
+
+        for (;;) {
+            const auto count{::read(worker.fd, buffer, sizeof(buffer))};
+
+            if (count > 0) {
+                worker.inbox.insert(worker.inbox.end(), buffer,
+                                    buffer + count);
+                continue;
+            }
+
+            if (count < 0 && errno == EINTR)
+                continue;
+
+            return count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+
+    // Move the next finished tile of a worker from its inbox into pixels
+    Inbox unpack(Worker &worker, std::vector<Vec3<T>> &pixels) const {
+        distributed_detail::TileHeader header{};
+
+        if (worker.inbox.size() < sizeof(header))
+            return Inbox::partial;
+
+        if (worker.outstanding.empty())
+            return Inbox::invalid;
+
+        std::memcpy(&header, worker.inbox.data(), sizeof(header));
+
+        const auto region{m_renderer.tile(worker.outstanding.front().tile)};
+
+        if (header.tile != worker.outstanding.front().tile ||
+            header.pixels != static_cast<std::uint32_t>(
+                                 (region.x1 - region.x0) *
+                                 (region.y1 - region.y0)))
+            return Inbox::invalid;
+
+        const std::size_t size{sizeof(header) +
+                               header.pixels * sizeof(Vec3<T>)};
+
+        if (worker.inbox.size() < size)
+            return Inbox::partial;
+
+        pixels.resize(header.pixels);
+        std::memcpy(pixels.data(), worker.inbox.data() + sizeof(header),
+                    header.pixels * sizeof(Vec3<T>));
+        worker.inbox.erase(worker.inbox.begin(),
+                           worker.inbox.begin() +
+                               static_cast<std::ptrdiff_t>(size));
+
+        return Inbox::tile;
+    }
+
+    bool busy() const {
+        return std::any_of(m_workers.begin(), m_workers.end(),
+                           [](const Worker &worker) {
+                               return worker.alive &&
+                                      !worker.outstanding.empty();
+                           });
+    }
+
+    // Whether the tile a worker is on has taken longer than the timeout
+    static bool overdue(const Worker &worker,
+                        std::chrono::steady_clock::time_point now,
+                        std::chrono::steady_clock::duration timeout) {
+        return !worker.outstanding.empty() &&
+               now - worker.outstanding.front().started > timeout;
+    }
+
+    // Untraced tiles first. Once there are none, tiles held only by a
+    // worker that is overdue, including those queued behind the late one.
+    std::uint32_t next_tile(std::deque<std::uint32_t> &pending,
+                            const std::vector<bool> &finished,
+                            const std::vector<int> &copies,
+                            std::chrono::steady_clock::time_point now,
+                            std::chrono::steady_clock::duration timeout) const {
+        while (!pending.empty()) {
+            const auto tile{pending.front()};
+            pending.pop_front();
+
+            if (!finished[tile])
+                return tile;
+        }
+
+        for (const auto &worker : m_workers) {
+            if (!worker.alive || !overdue(worker, now, timeout))
+                continue;
+
+            for (const auto &assignment : worker.outstanding) {
+                if (!finished[assignment.tile] && copies[assignment.tile] == 1)
+                    return assignment.tile;
+            }
+        }
+
+        return NO_TILE;
+    }
+
+    // Give up on a worker and put its unfinished tiles back in the queue
+    void fail(Worker &worker, std::deque<std::uint32_t> &pending,
+              const std::vector<bool> &finished, std::vector<int> &copies) {
+        worker.alive = false;
+        ::kill(worker.pid, SIGKILL);
+        ::close(worker.fd);
+        worker.fd = -1;
+        worker.inbox = {};
+
+        for (const auto &assignment : worker.outstanding) {
+            --copies[assignment.tile];
+
+            if (!finished[assignment.tile])
+                pending.push_front(assignment.tile);
+        }
+
+        worker.outstanding.clear();
+    }
+
+    void stop_workers() {
+        for (auto &worker : m_workers) {
+            if (worker.fd >= 0)
+                ::close(worker.fd);
+
+            worker.fd = -1;
+        }
+
+        // Closing the sockets ends the workers' loops; the kill also takes
+        // care of workers that are stuck
+        for (auto &worker : m_workers) {
+            ::kill(worker.pid, SIGKILL);
+
+            while (::waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR) {
+            }
+        }
+
+        m_workers.clear();
+    }
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef MINIRAY_FRAME_WRITER_HPP
+#define MINIRAY_FRAME_WRITER_HPP
+
+/*
+ * Streams a frame to a PPM file while it is still being traced. Tiles are
+ * reported as they finish. Once every pixel of the next band of rows is done,
+ * a writer thread converts the band to bytes and writes it in one call, so
+ * output overlaps with tracing and only the last band is left to write when
+ * the final tile comes in.
+ */
+#include "framebuffer.hpp"
+#include "image.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <ios>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mini_ray {
+
+class FrameWriter {
+  public:
+    // Rows are written band_height at a time; matching the tile size means
+    // a band is complete as soon as its row of tiles is
+    FrameWriter(const Framebuffer &frame, const std::string &path,
+                int band_height)
+        : m_frame{frame}, m_file{path, std::ios::binary},
+          m_band_height{std::max(1, band_height)},
+          m_remaining((frame.height() + m_band_height - 1) / m_band_height) {
+        for (std::size_t band = 0; band < m_remaining.size(); ++band)
+            m_remaining[band] = static_cast<std::size_t>(band_rows(band)) *
+                                frame.width();
+
+        write_ppm_header(m_file, frame.width(), frame.height());
+        m_thread = std::thread{[this] { write_loop(); }};
+    }
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Without finish() the frame is incomplete, e.g. because tracing threw;
+    // the writer gives up on the bands still missing
+    ~FrameWriter() {
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_abandoned = true;
+        }
+        m_ready.notify_all();
+
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    // The pixels of the tile are final and may be written out
+    void tile_done(const Tile &tile) {
+        bool completed{false};
+
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+
+            for (int band = tile.y0 / m_band_height;
+                 band * m_band_height < tile.y1; ++band) {
+                const int y0{std::max(tile.y0, band * m_band_height)};
+                const int y1{std::min(tile.y1, (band + 1) * m_band_height)};
+                auto &remaining{m_remaining[band]};
+
+                remaining -= static_cast<std::size_t>(y1 - y0) *
+                             (tile.x1 - tile.x0);
+                completed = completed || remaining == 0;
+            }
+        }
+
+        if (completed)
+            m_ready.notify_one();
+    }
+
+    // Wait until the whole frame is on disk. Every pixel must have been
+    // reported through tile_done() first.
+    void finish() {
+        m_thread.join();
+        m_file.close();
+    }
+
+  private:
+    const Framebuffer &m_frame;
+    std::ofstream m_file;
+    int m_band_height;
+    std::vector<std::size_t> m_remaining; // Pixels still to trace per band
+
+    std::mutex m_mutex{};
+    std::condition_variable m_ready{};
+    bool m_abandoned{false};
+    std::thread m_thread{};
+
+    int band_rows(std::size_t band) const {
+        const int y0{static_cast<int>(band) * m_band_height};
+
+        return std::min(y0 + m_band_height, m_frame.height()) - y0;
+    }
+
+    void write_loop() {
+        std::vector<unsigned char> bytes{};
+
+        for (std::size_t band = 0; band < m_remaining.size(); ++band) {
+            {
+                std::unique_lock<std::mutex> lock{m_mutex};
+                m_ready.wait(lock, [&] {
+                    return m_abandoned || m_remaining[band] == 0;
+                });
+
+                if (m_remaining[band] != 0)
+                    return;
+            }
+
+            const int y0{static_cast<int>(band) * m_band_height};
+
+            encode_rows(m_frame, y0, y0 + band_rows(band), bytes);
+            write_bytes(m_file, bytes);
+        }
+    }
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,440 @@
+#ifndef MINIRAY_FRAMEBUFFER_HPP
+#define MINIRAY_FRAMEBUFFER_HPP
+
+/*
+ * Compact storage for frames that are only written out, not filtered or
+ * accumulated. An Image<double> costs 24 bytes per pixel, which at 16K is
+ * over 3 GB; a framebuffer stores each pixel in one of these formats:
+ *
+ * - rgb_double: three doubles, 24 bytes
+ * - rgb_float: three floats, 12 bytes
+ * - rgb_half: three IEEE half floats, 6 bytes
+ * - rgbe: Ward's shared exponent format, 4 bytes, about 1% precision
+ * - native: the precision the frame is rendered in, which writes the same
+ *   file as an Image would; see stored_format()
+ *
+ * and places pixels in one of three layouts:
+ *
+ * - scanline: row major, as in Image
+ * - tiled: square tiles stored one after another, each row major, so a tile
+ *   worker writes one contiguous block when the tile size matches the
+ *   renderer's
+ * - morton: tiles as above, rounded up to a power of two, with the pixels of
+ *   each tile in Z order, so that small square neighbourhoods also share
+ *   cache lines
+ *
+ * Edge tiles are stored whole, so the tiled layouts waste a little memory on
+ * the right and bottom borders. Every layout finds a pixel as the sum of a
+ * row offset and a column offset looked up in two small tables, so neither
+ * storing nor reading back rows for encode_rows() and FrameWriter divides.
+ */
+#include "image.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace mini_ray {
+
+enum class PixelFormat { native, rgb_double, rgb_float, rgb_half, rgbe };
+enum class PixelLayout { scanline, tiled, morton };
+
+// The format that stores frames rendered at precision T
+template <typename T> PixelFormat stored_format(PixelFormat format) {
+    if (format != PixelFormat::native)
+        return format;
+
+    return sizeof(T) > sizeof(float) ? PixelFormat::rgb_double
+                                     : PixelFormat::rgb_float;
+}
+
+namespace framebuffer_detail {
+
+// Round to the nearest half float, ties to even
+inline std::uint16_t to_half(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const auto sign{static_cast<std::uint16_t>(bits >> 16 & 0x8000)};
+    bits &= 0x7FFFFFFF;
+
+    if (bits >= 0x7F800000) // Infinity or NaN
+        return sign | 0x7C00 | (bits > 0x7F800000 ? 0x200 : 0);
+
+    if (bits >= 0x477FF000) // Rounds past 65504, the largest half
+        return sign | 0x7C00;
+
+    if (bits < 0x38800000) { // Subnormal half: a multiple of 2^-24
+        float magnitude;
+        std::memcpy(&magnitude, &bits, sizeof(magnitude));
+
+        return sign |
+               static_cast<std::uint16_t>(std::nearbyint(magnitude * 0x1p24f));
+    }
+
+    // Rebias the exponent and round away the 13 low mantissa bits
+    const std::uint32_t rounded{bits + 0xFFF + (bits >> 13 & 1)};
+
+    return sign | static_cast<std::uint16_t>((rounded - 0x38000000) >> 13);
+}
+
+inline float from_half(std::uint16_t half) {
+    const std::uint32_t sign{std::uint32_t{half & 0x8000u} << 16};
+    const std::uint32_t exponent{half >> 10 & 0x1Fu};
+    const std::uint32_t mantissa{half & 0x3FFu};
+
+    if (exponent == 0) {
+        const float magnitude{static_cast<float>(mantissa) * 0x1p-24f};
+
+        return sign ? -magnitude : magnitude;
+    }
+
+    const std::uint32_t bits{
+        sign | (exponent == 31 ? 0x7F800000 : (exponent + 112) << 23) |
+        mantissa << 13};
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+// Ward's RGBE: three 8 bit mantissas sharing the exponent of the largest
+// channel. Negative channels are stored as 0.
+inline void to_rgbe(float r, float g, float b, std::uint8_t out[4]) {
+    const float largest{std::max({r, g, b})};
+
+    if (!(largest > 1e-32f)) {
+        out[0] = out[1] = out[2] = out[3] = 0;
+        return;
+    }
+
+    int exponent;
+    std::frexp(largest, &exponent);
+    exponent = std::min(exponent, 127);
+
+    const float scale{std::ldexp(256.0f, -exponent)};
+    const auto channel = [scale](float c) {
+        return static_cast<std::uint8_t>(
+            std::clamp(c * scale, 0.0f, 255.0f));
+    };
+
+    out[0] = channel(r);
+    out[1] = channel(g);
+    out[2] = channel(b);
+    out[3] = static_cast<std::uint8_t>(exponent + 128);
+}
+
+// Channels are reconstructed at the middle of their quantisation step
+inline Vec3<float> from_rgbe(const std::uint8_t in[4]) {
+    if (in[3] == 0)
+        return Vec3<float>{};
+
+    const float scale{std::ldexp(1.0f, in[3] - (128 + 8))};
+
+    return Vec3<float>{(in[0] + 0.5f) * scale, (in[1] + 0.5f) * scale,
+                       (in[2] + 0.5f) * scale};
+}
+
+// The bits of v spread to the even bit positions
+inline std::uint32_t spread_bits(std::uint32_t v) {
+    v = (v | v << 8) & 0x00FF00FF;
+    v = (v | v << 4) & 0x0F0F0F0F;
+    v = (v | v << 2) & 0x33333333;
+
+    return (v | v << 1) & 0x55555555;
+}
+
+} // namespace framebuffer_detail
+
+class Framebuffer {
+  public:
+    // tile_size is the edge of a tile in the tiled layouts; the morton
+    // layout rounds it up to a power of two. A native format stores doubles.
+    Framebuffer(int width, int height,
+                PixelFormat format = PixelFormat::rgb_float,
+                PixelLayout layout = PixelLayout::tiled, int tile_size = 32)
+        : m_width{width}, m_height{height},
+          m_format{stored_format<double>(format)},
+          m_layout{layout}, m_tile_size{tile_edge(layout, tile_size)},
+          m_units{units_per_pixel(m_format)} {
+        const std::size_t edge{static_cast<std::size_t>(m_tile_size)};
+        const std::size_t tiles_x{(width + edge - 1) / edge};
+
+        // A pixel's index is the sum of a part that depends only on its row
+        // and one that depends only on its column
+        m_row_offset.resize(height);
+        m_column_offset.resize(width);
+
+        for (int y = 0; y < height; ++y) {
+            const std::size_t tile_row{y / edge * tiles_x * edge * edge};
+
+            switch (layout) {
+            case PixelLayout::scanline:
+                m_row_offset[y] = static_cast<std::size_t>(y) * width;
+                break;
+            case PixelLayout::tiled:
+                m_row_offset[y] = tile_row + y % edge * edge;
+                break;
+            case PixelLayout::morton:
+                m_row_offset[y] =
+                    tile_row + (framebuffer_detail::spread_bits(y % edge) << 1);
+                break;
+            }
+        }
+
+        for (int x = 0; x < width; ++x) {
+            const std::size_t tile{x / edge * edge * edge};
+
+            switch (layout) {
+            case PixelLayout::scanline:
+                m_column_offset[x] = x;
+                break;
+            case PixelLayout::tiled:
+                m_column_offset[x] = tile + x % edge;
+                break;
+            case PixelLayout::morton:
+                m_column_offset[x] =
+                    tile + framebuffer_detail::spread_bits(x % edge);
+                break;
+            }
+        }
+
+        m_data.resize(stored_pixels(width, height, layout, m_tile_size) *
+                      m_units);
+    }
+
+    // Memory a framebuffer of these dimensions holds, offset tables included
+    static std::size_t bytes_needed(int width, int height, PixelFormat format,
+                                    PixelLayout layout, int tile_size = 32) {
+        return stored_pixels(width, height, layout,
+                             tile_edge(layout, tile_size)) *
+                   units_per_pixel(stored_format<double>(format)) *
+                   sizeof(Unit) +
+               (static_cast<std::size_t>(width) + height) *
+                   sizeof(std::size_t);
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    PixelFormat format() const { return m_format; }
+    PixelLayout layout() const { return m_layout; }
+    int tile_size() const { return m_tile_size; }
+
+    // Memory held for the pixels, padding included
+    std::size_t bytes() const { return m_data.size() * sizeof(Unit); }
+
+    // Distinct pixels may be stored from different threads at once
+    template <typename T> void store(int x, int y, const Vec3<T> &colour) {
+        Unit *pixel{&m_data[offset(x, y) * m_units]};
+
+        if (m_format == PixelFormat::rgb_double) {
+            const double channels[3]{static_cast<double>(colour.x),
+                                     static_cast<double>(colour.y),
+                                     static_cast<double>(colour.z)};
+            std::memcpy(pixel, channels, sizeof(channels));
+            return;
+        }
+
+        const float r{static_cast<float>(colour.x)};
+        const float g{static_cast<float>(colour.y)};
+        const float b{static_cast<float>(colour.z)};
+
+        switch (m_format) {
+        case PixelFormat::native:
+        case PixelFormat::rgb_double:
+        case PixelFormat::rgb_float: {
+            const float channels[3]{r, g, b};
+            std::memcpy(pixel, channels, sizeof(channels));
+            break;
+        }
+        case PixelFormat::rgb_half:
+            pixel[0] = framebuffer_detail::to_half(r);
+            pixel[1] = framebuffer_detail::to_half(g);
+            pixel[2] = framebuffer_detail::to_half(b);
+            break;
+        case PixelFormat::rgbe: {
+            std::uint8_t bytes[4];
+            framebuffer_detail::to_rgbe(r, g, b, bytes);
+            std::memcpy(pixel, bytes, sizeof(bytes));
+            break;
+        }
+        }
+    }
+
+    Vec3<double> load(int x, int y) const {
+        Vec3<double> colour{};
+        read_pixels(m_row_offset[y], &m_column_offset[x], 1, &colour);
+
+        return colour;
+    }
+
+    // Decode row y into out[0, width), left to right. Channels are decoded
+    // at precision U; the PPM bytes of the native format match an Image only
+    // when U is the precision the frame was rendered in.
+    template <typename U> void read_row(int y, Vec3<U> *out) const {
+        read_pixels(m_row_offset[y], m_column_offset.data(), m_width, out);
+    }
+
+    // The frame in scanline order at precision T
+    template <typename T> Image<T> image() const {
+        Image<T> image{m_width, m_height};
+
+        for (int y = 0; y < m_height; ++y)
+            read_row(y, &image.at(0, y));
+
+        return image;
+    }
+
+  private:
+    // Storage granule; every format is a whole number of them
+    using Unit = std::uint16_t;
+
+    int m_width, m_height;
+    PixelFormat m_format;
+    PixelLayout m_layout;
+    int m_tile_size;
+    std::size_t m_units; // Per pixel
+    std::vector<std::size_t> m_row_offset{}, m_column_offset{};
+    std::vector<Unit> m_data{};
+
+    static int tile_edge(PixelLayout layout, int tile_size) {
+        int edge{std::max(1, tile_size)};
+
+        if (layout == PixelLayout::morton) {
+            // Spread coordinates must fit in 16 bits
+            edge = std::min(edge, 1 << 15);
+            int power{1};
+
+            while (power < edge)
+                power *= 2;
+
+            edge = power;
+        }
+
+        return edge;
+    }
+
+    // Pixels stored, edge tiles padded to whole tiles
+    static std::size_t stored_pixels(int width, int height,
+                                     PixelLayout layout, int edge) {
+        if (layout == PixelLayout::scanline)
+            return static_cast<std::size_t>(width) * height;
+
+        const std::size_t size{static_cast<std::size_t>(edge)};
+
+        return (width + size - 1) / size * ((height + size - 1) / size) *
+               size * size;
+    }
+
+    static std::size_t units_per_pixel(PixelFormat format) {
+        switch (format) {
+        case PixelFormat::rgb_half:
+            return 3;
+        case PixelFormat::rgbe:
+            return 2;
+        case PixelFormat::rgb_float:
+            return 6;
+        case PixelFormat::native:
+        case PixelFormat::rgb_double:
+            break;
+        }
+
+        return 12;
+    }
+
+    // Index of the pixel in units of whole pixels
+    std::size_t offset(int x, int y) const {
+        return m_row_offset[y] + m_column_offset[x];
+    }
+
+    template <PixelFormat Format, typename U>
+    static Vec3<U> decode(const Unit *pixel) {
+        if constexpr (Format == PixelFormat::rgb_double) {
+            double channels[3];
+            std::memcpy(channels, pixel, sizeof(channels));
+
+            return Vec3<U>{Vec3<double>{channels[0], channels[1],
+                                        channels[2]}};
+        } else if constexpr (Format == PixelFormat::rgb_half) {
+            return Vec3<U>{
+                Vec3<float>{framebuffer_detail::from_half(pixel[0]),
+                            framebuffer_detail::from_half(pixel[1]),
+                            framebuffer_detail::from_half(pixel[2])}};
+        } else if constexpr (Format == PixelFormat::rgbe) {
+            std::uint8_t bytes[4];
+            std::memcpy(bytes, pixel, sizeof(bytes));
+
+            return Vec3<U>{framebuffer_detail::from_rgbe(bytes)};
+        } else {
+            float channels[3];
+            std::memcpy(channels, pixel, sizeof(channels));
+
+            return Vec3<U>{Vec3<float>{channels[0], channels[1],
+                                       channels[2]}};
+        }
+    }
+
+    // Decode the count pixels at row + columns[i]
+    template <PixelFormat Format, typename U>
+    void read_as(std::size_t row, const std::size_t *columns, int count,
+                 Vec3<U> *out) const {
+        const Unit *base{&m_data[row * m_units]};
+
+        for (int i = 0; i < count; ++i)
+            out[i] = decode<Format, U>(base + columns[i] * m_units);
+    }
+
+    template <typename U>
+    void read_pixels(std::size_t row, const std::size_t *columns, int count,
+                     Vec3<U> *out) const {
+        switch (m_format) {
+        case PixelFormat::rgb_float:
+            return read_as<PixelFormat::rgb_float>(row, columns, count, out);
+        case PixelFormat::rgb_half:
+            return read_as<PixelFormat::rgb_half>(row, columns, count, out);
+        case PixelFormat::rgbe:
+            return read_as<PixelFormat::rgbe>(row, columns, count, out);
+        case PixelFormat::native:
+        case PixelFormat::rgb_double:
+            break;
+        }
+
+        read_as<PixelFormat::rgb_double>(row, columns, count, out);
+    }
+};
+
+// Convert rows [y0, y1) to PPM pixel data, replacing the contents of bytes
+inline void encode_rows(const Framebuffer &frame, int y0, int y1,
+                        std::vector<unsigned char> &bytes) {
+    bytes.resize(static_cast<std::size_t>(y1 - y0) * frame.width() * 3);
+    auto *out{bytes.data()};
+
+    // Bytes are computed at the precision the channels are stored in
+    const auto encode = [&](auto &row) {
+        for (int y = y0; y < y1; ++y) {
+            frame.read_row(y, row.data());
+
+            for (const auto &pixel : row) {
+                *out++ = to_byte(pixel.x);
+                *out++ = to_byte(pixel.y);
+                *out++ = to_byte(pixel.z);
+            }
+        }
+    };
+
+    if (frame.format() == PixelFormat::rgb_double) {
+        std::vector<Vec3<double>> row(frame.width());
+        encode(row);
+    } else {
+        std::vector<Vec3<float>> row(frame.width());
+        encode(row);
+    }
+}
+
+} // namespace mini_ray
+
+#endif
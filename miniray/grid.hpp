@@ -0,0 +1,379 @@
+#ifndef MINIRAY_GRID_HPP
+#define MINIRAY_GRID_HPP
+
+/*
+ * Uniform grid over axis aligned boxes, an alternative to the BVH for dense
+ * scenes of similar sized primitives. Every primitive is listed in each cell
+ * its box overlaps, and a ray walks the cells it crosses front to back with
+ * a 3D-DDA (Amanatides & Woo), so finding the next candidates costs a few
+ * additions instead of a chain of box tests and stack operations.
+ *
+ * A grid suits such scenes but degrades badly when sizes vary: one huge box
+ * lands in thousands of cells, or the cells are sized for it and hold
+ * thousands of the small ones. Boxes far larger than the typical one are
+ * therefore kept out of the cells and handed to every query instead, which
+ * is what a ground plane made of a huge sphere needs.
+ *
+ * Like the BVH the grid only knows about boxes; the leaf callbacks receive
+ * lists of primitive indices. Lists are padded so that reading up to LANES
+ * indices past the end of any of them is safe; the extra entries are 0.
+ */
+#include "bvh.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace mini_ray {
+
+// Which structure answers the ray queries of a scene
+enum class Accelerator {
+    bvh,
+    grid,
+    automatic // Whichever choose_accelerator() picks for the spheres
+};
+
+namespace grid_detail {
+
+// Largest half extent of a box, the radius for a sphere's bounds
+template <typename T> T size(const Aabb<T> &b) {
+    const Vec3<T> e{b.max - b.min};
+
+    return std::max({e.x, e.y, e.z}) / 2;
+}
+
+template <typename T> T median_size(const std::vector<Aabb<T>> &bounds) {
+    std::vector<T> sizes{};
+    sizes.reserve(bounds.size());
+
+    for (const auto &b : bounds)
+        sizes.push_back(size(b));
+
+    auto middle{sizes.begin() + static_cast<std::ptrdiff_t>(sizes.size() / 2)};
+    std::nth_element(sizes.begin(), middle, sizes.end());
+
+    return *middle;
+}
+
+} // namespace grid_detail
+
+template <typename T> class UniformGrid {
+  public:
+    static constexpr std::size_t LANES{SIMD_LANES<T>};
+    // Cells per primitive; about two keeps most cells to a handful of
+    // primitives without leaving most of them empty
+    static constexpr T DENSITY{2};
+    static constexpr int MAX_RESOLUTION{512}; // Cells along one axis
+    // Boxes larger than this many times the median are not put in cells
+    static constexpr T LARGE_FACTOR{8};
+
+    UniformGrid() = default;
+
+    explicit UniformGrid(const std::vector<Aabb<T>> &bounds) {
+        if (bounds.empty()) {
+            pad();
+            return;
+        }
+
+        const T limit{LARGE_FACTOR * grid_detail::median_size(bounds)};
+        std::vector<std::uint32_t> small{};
+
+        for (std::uint32_t i = 0; i < bounds.size(); ++i) {
+            if (grid_detail::size(bounds[i]) > limit) {
+                m_large.push_back(i);
+            } else {
+                small.push_back(i);
+                m_bounds.grow(bounds[i]);
+            }
+        }
+
+        resolve(small.size());
+        fill(bounds, small);
+        pad();
+    }
+
+    const std::array<int, 3> &resolution() const { return m_resolution; }
+    // Primitives left out of the cells and tested by every query
+    std::size_t large_count() const { return m_large.size() - LANES; }
+    // Cell entries, counting a primitive once per cell it overlaps
+    std::size_t entry_count() const { return m_items.size() - LANES; }
+
+    // Cells pierced by the ray, front to back, until the nearest hit found
+    // so far lies in a cell already visited. leaf(items, count, t_max)
+    // tests the listed primitives and may shrink t_max. A primitive in
+    // several cells is offered once per cell. Unlike the BVH the walk
+    // compares hit distances with cell boundaries, so ray_dir must have unit
+    // length, as it does everywhere in the renderer.
+    template <typename Leaf>
+    void closest(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir, T &t_max,
+                 Leaf &&leaf) const {
+        if (large_count() > 0)
+            leaf(m_large.data(), large_count(), t_max);
+
+        walk(ray_orig, ray_dir, t_max,
+             [&](const std::uint32_t *items, std::uint32_t count) {
+                 leaf(items, count, t_max);
+                 return false;
+             });
+    }
+
+    // As closest() but stops as soon as leaf(items, count) returns true,
+    // which it should once anything listed is hit
+    template <typename Leaf>
+    bool any(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+             Leaf &&leaf) const {
+        if (large_count() > 0 && leaf(m_large.data(), large_count()))
+            return true;
+
+        const T t_max{std::numeric_limits<T>::infinity()};
+
+        return walk(ray_orig, ray_dir, t_max, leaf);
+    }
+
+  private:
+    Aabb<T> m_bounds{};
+    std::array<int, 3> m_resolution{0, 0, 0};
+    Vec3<T> m_cell_size{};
+    Vec3<T> m_inv_cell_size{};
+    // Entries of cell c are m_items[m_cell_start[c], m_cell_start[c + 1])
+    std::vector<std::uint32_t> m_cell_start{0};
+    std::vector<std::uint32_t> m_items{};
+    std::vector<std::uint32_t> m_large{};
+
+    static T component(const Vec3<T> &v, int axis) {
+        return Aabb<T>::component(v, axis);
+    }
+
+    void pad() {
+        m_items.resize(m_items.size() + LANES, 0);
+        m_large.resize(m_large.size() + LANES, 0);
+    }
+
+    // Cells of roughly equal edge, about DENSITY per primitive
+    void resolve(std::size_t count) {
+        if (count == 0)
+            return;
+
+        Vec3<T> extent{m_bounds.max - m_bounds.min};
+        const T longest{std::max({extent.x, extent.y, extent.z})};
+
+        // A flat or thin set still needs cells of some depth
+        const T least{std::max(longest / 1024, std::numeric_limits<T>::min())};
+        extent = Vec3<T>{std::max(extent.x, least), std::max(extent.y, least),
+                         std::max(extent.z, least)};
+        m_bounds.max = m_bounds.min + extent;
+
+        const double edge{std::cbrt(static_cast<double>(extent.x) * extent.y *
+                                    extent.z / (DENSITY * count))};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const double cells{std::ceil(component(extent, axis) / edge)};
+
+            m_resolution[axis] = static_cast<int>(
+                std::clamp(cells, 1.0, static_cast<double>(MAX_RESOLUTION)));
+        }
+
+        m_cell_size = Vec3<T>{extent.x / m_resolution[0],
+                              extent.y / m_resolution[1],
+                              extent.z / m_resolution[2]};
+        m_inv_cell_size = Vec3<T>{m_resolution[0] / extent.x,
+                                  m_resolution[1] / extent.y,
+                                  m_resolution[2] / extent.z};
+    }
+
+    // Cell along axis holding coordinate v, clamped to the grid
+    int cell(T v, int axis) const {
+        const T c{std::floor((v - component(m_bounds.min, axis)) *
+                             component(m_inv_cell_size, axis))};
+
+        return static_cast<int>(
+            std::clamp(c, T{0}, static_cast<T>(m_resolution[axis] - 1)));
+    }
+
+    std::size_t cell_index(int x, int y, int z) const {
+        return (static_cast<std::size_t>(z) * m_resolution[1] + y) *
+                   m_resolution[0] +
+               x;
+    }
+
+    // Counting sort of the primitives into the cells their boxes overlap
+    void fill(const std::vector<Aabb<T>> &bounds,
+              const std::vector<std::uint32_t> &small) {
+        if (small.empty())
+            return;
+
+        const std::size_t cells{static_cast<std::size_t>(m_resolution[0]) *
+                                m_resolution[1] * m_resolution[2]};
+        m_cell_start.assign(cells + 1, 0);
+
+        const auto for_each_cell = [&](const Aabb<T> &b, auto &&f) {
+            const int x0{cell(b.min.x, 0)}, x1{cell(b.max.x, 0)};
+            const int y0{cell(b.min.y, 1)}, y1{cell(b.max.y, 1)};
+            const int z0{cell(b.min.z, 2)}, z1{cell(b.max.z, 2)};
+
+            for (int z = z0; z <= z1; ++z) {
+                for (int y = y0; y <= y1; ++y) {
+                    for (int x = x0; x <= x1; ++x)
+                        f(cell_index(x, y, z));
+                }
+            }
+        };
+
+        for (auto i : small)
+            for_each_cell(bounds[i], [&](std::size_t c) { ++m_cell_start[c]; });
+
+        std::uint32_t total{0};
+
+        for (auto &start : m_cell_start) {
+            const std::uint32_t count{start};
+            start = total;
+            total += count;
+        }
+
+        // Filled in increasing index order, using the starts as cursors and
+        // shifting them back afterwards
+        m_items.resize(total);
+
+        for (auto i : small)
+            for_each_cell(bounds[i], [&](std::size_t c) {
+                m_items[m_cell_start[c]++] = i;
+            });
+
+        for (std::size_t c = cells; c > 0; --c)
+            m_cell_start[c] = m_cell_start[c - 1];
+
+        m_cell_start[0] = 0;
+    }
+
+    // 3D-DDA through the cells of the ray segment [0, t_max], calling
+    // visit(items, count) on each non-empty one until it returns true or
+    // t_max, which visit may shrink, ends before the next cell
+    template <typename Visit>
+    bool walk(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir, const T &t_max,
+              Visit &&visit) const {
+        // Degenerate shading can produce NaN rays, which hit nothing in the
+        // BVH but would take the walk outside the grid
+        if (m_items.size() == LANES ||
+            std::isnan(ray_orig.x + ray_orig.y + ray_orig.z + ray_dir.x +
+                       ray_dir.y + ray_dir.z))
+            return false;
+
+        const Vec3<T> inv_dir{Bvh<T>::inverse(ray_dir)};
+        T t_enter{0}, t_exit{t_max};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            T t0{(component(m_bounds.min, axis) - component(ray_orig, axis)) *
+                 component(inv_dir, axis)};
+            T t1{(component(m_bounds.max, axis) - component(ray_orig, axis)) *
+                 component(inv_dir, axis)};
+
+            if (t0 > t1)
+                std::swap(t0, t1);
+
+            t_enter = std::max(t_enter, t0);
+            t_exit = std::min(t_exit, t1);
+        }
+
+        MINIRAY_COUNT(box_tests, 1);
+
+        if (t_enter > t_exit)
+            return false;
+
+        const Vec3<T> start{ray_orig + ray_dir * t_enter};
+        std::array<int, 3> cell{}, step{};
+        std::array<T, 3> t_next{}, t_delta{};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const T d{component(ray_dir, axis)};
+
+            cell[axis] = this->cell(component(start, axis), axis);
+
+            if (d == 0) {
+                step[axis] = 0;
+                t_next[axis] = std::numeric_limits<T>::infinity();
+                t_delta[axis] = 0;
+                continue;
+            }
+
+            step[axis] = d > 0 ? 1 : -1;
+
+            const T boundary{component(m_bounds.min, axis) +
+                             static_cast<T>(cell[axis] + (d > 0)) *
+                                 component(m_cell_size, axis)};
+
+            t_next[axis] = (boundary - component(ray_orig, axis)) *
+                           component(inv_dir, axis);
+            t_delta[axis] = component(m_cell_size, axis) *
+                            std::abs(component(inv_dir, axis));
+        }
+
+        while (true) {
+            const std::size_t c{cell_index(cell[0], cell[1], cell[2])};
+            const std::uint32_t first{m_cell_start[c]};
+            const std::uint32_t count{m_cell_start[c + 1] - first};
+
+            MINIRAY_COUNT(box_tests, 1);
+
+            if (count > 0 && visit(m_items.data() + first, count))
+                return true;
+
+            const int axis{t_next[0] < t_next[1]
+                               ? (t_next[0] < t_next[2] ? 0 : 2)
+                               : (t_next[1] < t_next[2] ? 1 : 2)};
+            const T t_leave{t_next[axis]};
+
+            // A hit exactly on the boundary may tie with one beyond it
+            if (t_max < t_leave || t_leave > t_exit)
+                return false;
+
+            cell[axis] += step[axis];
+
+            if (cell[axis] < 0 || cell[axis] >= m_resolution[axis])
+                return false;
+
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+// The grid for dense sets of similar sized spheres, the BVH otherwise. Sizes
+// are compared between the 10th and 90th percentiles, leaving the odd ground
+// plane or light to the list of large spheres the grid tests separately, and
+// small scenes stay with the BVH, which handles them well either way.
+template <typename T>
+Accelerator choose_accelerator(const std::vector<Aabb<T>> &bounds) {
+    constexpr std::size_t MIN_COUNT{1024};
+    constexpr T MAX_SPREAD{4};
+
+    if (bounds.size() < MIN_COUNT)
+        return Accelerator::bvh;
+
+    std::vector<T> sizes{};
+    sizes.reserve(bounds.size());
+
+    for (const auto &b : bounds)
+        sizes.push_back(grid_detail::size(b));
+
+    const auto at = [&](std::size_t percent) {
+        auto it{sizes.begin() +
+                static_cast<std::ptrdiff_t>(sizes.size() * percent / 100)};
+        std::nth_element(sizes.begin(), it, sizes.end());
+
+        return *it;
+    };
+
+    const T low{at(10)}, high{at(90)};
+
+    return high <= MAX_SPREAD * low ? Accelerator::grid : Accelerator::bvh;
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef MINIRAY_IMAGE_HPP
+#define MINIRAY_IMAGE_HPP
+
+/*
+ * A rendered frame held in memory, its PPM output, and a comparison between
+ * two frames, used to measure how far a single precision render drifts from
+ * the double precision one.
+ */
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <ios>
+#include <string>
+#include <vector>
+
+namespace mini_ray {
+
+// Pixels [x0, x1) x [y0, y1)
+struct Tile {
+    int x0{}, y0{}, x1{}, y1{};
+};
+
+template <typename T> struct Image {
+    int width{}, height{};
+    std::vector<Vec3<T>> pixels{}; // Row major, top row first
+
+    Image(int width, int height)
+        : width{width}, height{height},
+          pixels(static_cast<std::size_t>(width) * height) {}
+
+    Vec3<T> &at(int x, int y) {
+        return pixels[static_cast<std::size_t>(y) * width + x];
+    }
+    const Vec3<T> &at(int x, int y) const {
+        return pixels[static_cast<std::size_t>(y) * width + x];
+    }
+};
+
+// Channel value as written to the file; anything brighter than 1 saturates
+template <typename T> unsigned char to_byte(T c) {
+    return static_cast<unsigned char>(std::min(static_cast<T>(1), c) * 255);
+}
+
+// Luminance of a colour as displayed, in [0, 1]
+template <typename T> double display_luminance(const Vec3<T> &colour) {
+    return 0.2126 * std::min(1.0, static_cast<double>(colour.x)) +
+           0.7152 * std::min(1.0, static_cast<double>(colour.y)) +
+           0.0722 * std::min(1.0, static_cast<double>(colour.z));
+}
+
+inline void write_ppm_header(std::ofstream &ofs, int width, int height) {
+    ofs << "P6\n" << width << " " << height << "\n255\n";
+}
+
+// Convert rows [y0, y1) to PPM pixel data, replacing the contents of bytes
+template <typename T>
+void encode_rows(const Image<T> &image, int y0, int y1,
+                 std::vector<unsigned char> &bytes) {
+    bytes.resize(static_cast<std::size_t>(y1 - y0) * image.width * 3);
+    auto *out{bytes.data()};
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = 0; x < image.width; ++x) {
+            const auto &pixel{image.at(x, y)};
+            *out++ = to_byte(pixel.x);
+            *out++ = to_byte(pixel.y);
+            *out++ = to_byte(pixel.z);
+        }
+    }
+}
+
+inline void write_bytes(std::ofstream &ofs,
+                        const std::vector<unsigned char> &bytes) {
+    ofs.write(reinterpret_cast<const char *>(bytes.data()),
+              static_cast<std::streamsize>(bytes.size()));
+}
+
+// Write a finished frame, a band of rows per write call
+template <typename T>
+void write_ppm(const Image<T> &image, const std::string &path) {
+    constexpr int band_height{64};
+    std::ofstream ofs(path, std::ios::binary);
+    std::vector<unsigned char> bytes{};
+
+    write_ppm_header(ofs, image.width, image.height);
+
+    for (int y = 0; y < image.height; y += band_height) {
+        encode_rows(image, y, std::min(y + band_height, image.height), bytes);
+        write_bytes(ofs, bytes);
+    }
+
+    ofs.close();
+}
+
+struct ImageError {
+    double max_abs{0};  // Largest difference of a displayed channel
+    double mean_abs{0}; // Mean difference over all displayed channels
+    std::size_t differing_bytes{0}; // Channels whose output byte changed
+};
+
+// Difference between two frames of the same size, measured on the values
+// that end up in the file (saturated at 1)
+template <typename A, typename B>
+ImageError image_error(const Image<A> &image, const Image<B> &reference) {
+    ImageError error{};
+    double total{0};
+
+    for (std::size_t i = 0; i < image.pixels.size(); ++i) {
+        const auto &p{image.pixels[i]};
+        const auto &r{reference.pixels[i]};
+
+        for (auto [a, b] : {std::pair{p.x, r.x}, std::pair{p.y, r.y},
+                            std::pair{p.z, r.z}}) {
+            const double difference{
+                std::abs(std::min(1.0, static_cast<double>(a)) -
+                         std::min(1.0, static_cast<double>(b)))};
+
+            error.max_abs = std::max(error.max_abs, difference);
+            total += difference;
+            error.differing_bytes += to_byte(a) != to_byte(b);
+        }
+    }
+
+    if (!image.pixels.empty())
+        error.mean_abs = total / (3.0 * image.pixels.size());
+
+    return error;
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef MINIRAY_LIGHTS_HPP
+#define MINIRAY_LIGHTS_HPP
+
+/*
+ * The emissive spheres of a scene, found once when the scene is built rather
+ * than on every diffuse hit. Lights are listed in input order, which is the
+ * order their contributions are summed in, and carry a CDF over emitted power
+ * so a bounded number of them can be importance sampled per shading point.
+ */
+#include "sphere_set.hpp"
+#include "storage.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+template <typename T> class LightList {
+  public:
+    struct Sample {
+        std::size_t index{}; // Scene index of the light
+        double pdf{};        // Probability of having picked it
+    };
+
+    LightList() = default;
+
+    LightList(const SphereSet<T> &spheres,
+              const Storage<std::size_t> &input_order) {
+        auto &indices{m_indices.owned()};
+        auto &cdf{m_cdf.owned()};
+        double total{0};
+
+        for (auto i : input_order) {
+            const auto &emission{spheres.material(i).emission_colour};
+
+            if (emission.x > 0) {
+                indices.push_back(i);
+                total += power(emission);
+                cdf.push_back(total);
+            }
+        }
+
+        for (auto &c : cdf)
+            c /= total;
+    }
+
+    // A list found earlier, e.g. borrowed from a scene file
+    LightList(Storage<std::size_t> indices, Storage<double> cdf)
+        : m_indices{std::move(indices)}, m_cdf{std::move(cdf)} {}
+
+    std::size_t size() const { return m_indices.size(); }
+    bool empty() const { return m_indices.empty(); }
+
+    // Scene indices of the lights, in input order
+    const Storage<std::size_t> &indices() const { return m_indices; }
+    // Cumulative share of the total power, per light
+    const Storage<double> &cdf() const { return m_cdf; }
+
+    // Pick a light in proportion to its power, u in [0, 1)
+    Sample sample(double u) const {
+        const auto it{std::upper_bound(m_cdf.begin(), m_cdf.end(), u)};
+        const auto i{std::min<std::size_t>(it - m_cdf.begin(), size() - 1)};
+        const double lower{i == 0 ? 0 : m_cdf[i - 1]};
+
+        return Sample{m_indices[i], m_cdf[i] - lower};
+    }
+
+  private:
+    Storage<std::size_t> m_indices{};
+    Storage<double> m_cdf{};
+
+    // Luminance of the emission, kept away from zero so every light can be
+    // picked. The CDF is kept in double whatever the scene precision.
+    static double power(const Vec3<T> &emission) {
+        return std::max(0.2126 * emission.x + 0.7152 * emission.y +
+                            0.0722 * emission.z,
+                        1e-12);
+    }
+};
+
+} // namespace mini_ray
+
+#endif
@@ -1,28 +1,424 @@
 #include "miniray.hpp"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <utility>
 #include <vector>
 
+namespace {
+
+// Look name up in a table of (name, value) pairs
+template <typename T, std::size_t N>
+bool parse_choice(const char *name,
+                  const std::pair<const char *, T> (&choices)[N], T &value) {
+    for (const auto &[choice, choice_value] : choices) {
+        if (std::strcmp(name, choice) == 0) {
+            value = choice_value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+constexpr std::pair<const char *, mini_ray::PixelFormat> PIXEL_FORMATS[]{
+    {"native", mini_ray::PixelFormat::native},
+    {"double", mini_ray::PixelFormat::rgb_double},
+    {"float", mini_ray::PixelFormat::rgb_float},
+    {"half", mini_ray::PixelFormat::rgb_half},
+    {"rgbe", mini_ray::PixelFormat::rgbe}};
+
+constexpr std::pair<const char *, mini_ray::PixelLayout> PIXEL_LAYOUTS[]{
+    {"scanline", mini_ray::PixelLayout::scanline},
+    {"tiled", mini_ray::PixelLayout::tiled},
+    {"morton", mini_ray::PixelLayout::morton}};
+
+constexpr std::pair<const char *, mini_ray::PixelOrder> PIXEL_ORDERS[]{
+    {"scanline", mini_ray::PixelOrder::scanline},
+    {"tiled", mini_ray::PixelOrder::tiled},
+    {"morton", mini_ray::PixelOrder::morton},
+    {"hilbert", mini_ray::PixelOrder::hilbert}};
+
+constexpr std::pair<const char *, mini_ray::Accelerator> ACCELERATORS[]{
+    {"bvh", mini_ray::Accelerator::bvh},
+    {"grid", mini_ray::Accelerator::grid},
+    {"auto", mini_ray::Accelerator::automatic}};
+
+} // namespace
+
 int main(int argc, char const *argv[]) {
-    srand48(13);
-    std::vector<mini_ray::Sphere> spheres{};
-
-    spheres.emplace_back(mini_ray::Vec3f{0.0, -10004, -20}, 10000,
-                         mini_ray::Vec3f{0.20, 0.20, 0.20}, 0, 0.0);
-    spheres.emplace_back(mini_ray::Vec3f{0.0, 0, -20}, 4,
-                         mini_ray::Vec3f{1.00, 0.32, 0.36}, 1, 0.5);
-    spheres.emplace_back(mini_ray::Vec3f{5.0, -1, -15}, 2,
-                         mini_ray::Vec3f{0.90, 0.76, 0.46}, 1, 0.0);
-    spheres.emplace_back(mini_ray::Vec3f{5.0, 0, -25}, 3,
-                         mini_ray::Vec3f{0.65, 0.77, 0.97}, 1, 0.0);
-    spheres.emplace_back(mini_ray::Vec3f{-5.5, 0, -15}, 3,
-                         mini_ray::Vec3f{0.90, 0.90, 0.90}, 1, 0.0);
-    // light
-    spheres.emplace_back(mini_ray::Vec3f{0.0, 20, -30}, 3,
-                         mini_ray::Vec3f{0.00, 0.00, 0.00}, 0, 0.0,
-                         mini_ray::Vec3f{3});
-
-    render(spheres);
+    mini_ray::RenderOptions options{};
+    mini_ray::ProgressiveOptions progressive_options{};
+    mini_ray::AdaptiveOptions adaptive_options{};
+    mini_ray::DistributedOptions distributed_options{};
+    mini_ray::DenoiseOptions denoise_options{};
+    mini_ray::StreamOptions stream_options{};
+    mini_ray::RenderStats render_stats{};
+    mini_ray::Accelerator accelerator{mini_ray::Accelerator::automatic};
+    bool single_precision{false}, compare_precision{false}, progressive{false},
+        adaptive{false}, print_stats{false}, distributed{false},
+        denoise{false}, streamed{false};
+    int frames{0};
+    std::string scene_path{}, heatmap_path{}, aov_prefix{};
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            options.width = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--height") == 0 && i + 1 < argc) {
+            options.height = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+            options.tile_size = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--no-packets") == 0) {
+            options.packets = false;
+        } else if (std::strcmp(argv[i], "--pixel-order") == 0 &&
+                   i + 1 < argc &&
+                   parse_choice(argv[i + 1], PIXEL_ORDERS,
+                                options.pixel_order)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--wavefront") == 0) {
+            options.engine = mini_ray::Engine::wavefront;
+        } else if (std::strcmp(argv[i], "--no-sort") == 0) {
+            options.sort_queues = false;
+        } else if (std::strcmp(argv[i], "--light-samples") == 0 &&
+                   i + 1 < argc) {
+            options.light_samples = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+            options.max_depth = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--min-throughput") == 0 &&
+                   i + 1 < argc) {
+            options.min_throughput = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--roulette-depth") == 0 &&
+                   i + 1 < argc) {
+            options.roulette_depth = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--precision") == 0 && i + 1 < argc &&
+                   (std::strcmp(argv[i + 1], "float") == 0 ||
+                    std::strcmp(argv[i + 1], "double") == 0)) {
+            single_precision = std::strcmp(argv[++i], "float") == 0;
+        } else if (std::strcmp(argv[i], "--pixel-format") == 0 &&
+                   i + 1 < argc &&
+                   parse_choice(argv[i + 1], PIXEL_FORMATS,
+                                options.pixel_format)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--pixel-layout") == 0 &&
+                   i + 1 < argc &&
+                   parse_choice(argv[i + 1], PIXEL_LAYOUTS,
+                                options.pixel_layout)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--compare-precision") == 0) {
+            compare_precision = true;
+        } else if (std::strcmp(argv[i], "--progressive") == 0) {
+            progressive = true;
+        } else if (std::strcmp(argv[i], "--max-samples") == 0 &&
+                   i + 1 < argc) {
+            progressive_options.max_samples = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--noise-threshold") == 0 &&
+                   i + 1 < argc) {
+            progressive_options.noise_threshold = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--denoise") == 0) {
+            denoise = true;
+        } else if (std::strcmp(argv[i], "--denoise-iterations") == 0 &&
+                   i + 1 < argc) {
+            denoise_options.iterations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--aov") == 0 && i + 1 < argc) {
+            aov_prefix = argv[++i];
+        } else if (std::strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = true;
+        } else if (std::strcmp(argv[i], "--aa-samples") == 0 && i + 1 < argc) {
+            adaptive_options.max_samples = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--contrast") == 0 && i + 1 < argc) {
+            adaptive_options.contrast_threshold = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--accelerator") == 0 &&
+                   i + 1 < argc &&
+                   parse_choice(argv[i + 1], ACCELERATORS, accelerator)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            distributed = true;
+            distributed_options.workers = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--tile-timeout") == 0 &&
+                   i + 1 < argc) {
+            distributed_options.tile_timeout = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--memory-budget") == 0 &&
+                   i + 1 < argc) {
+            streamed = true;
+            stream_options.memory_budget =
+                std::strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (std::strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            heatmap_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--width N] [--height N] [--threads N]"
+                         " [--tile-size N] [--no-packets]"
+                         " [--pixel-order scanline|tiled|morton|hilbert]"
+                         " [--wavefront] [--no-sort] [--light-samples N]"
+                         " [--max-depth N] [--min-throughput X]"
+                         " [--roulette-depth N]"
+                         " [--precision float|double] [--compare-precision]"
+                         " [--pixel-format native|double|float|half|rgbe]"
+                         " [--pixel-layout scanline|tiled|morton]"
+                         " [--progressive] [--max-samples N]"
+                         " [--noise-threshold X] [--denoise]"
+                         " [--denoise-iterations N] [--aov PREFIX]"
+                         " [--adaptive]"
+                         " [--aa-samples N] [--contrast X]"
+                         " [--scene FILE] [--accelerator bvh|grid|auto]"
+                         " [--stats] [--heatmap FILE]"
+                         " [--workers N] [--tile-timeout SECONDS]"
+                         " [--frames N] [--memory-budget MB]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.width <= 0 || options.height <= 0) {
+        std::cerr << "--width and --height must be positive" << std::endl;
+        return 1;
+    }
+
+    if (options.max_depth < 0 ||
+        options.max_depth > mini_ray::MAX_TRACE_DEPTH) {
+        std::cerr << "--max-depth must be between 0 and "
+                  << mini_ray::MAX_TRACE_DEPTH << std::endl;
+        return 1;
+    }
+
+    if ((denoise || !aov_prefix.empty()) && adaptive) {
+        std::cerr << "--denoise and --aov cannot be combined with --adaptive"
+                  << std::endl;
+        return 1;
+    }
+
+    if (denoise || !aov_prefix.empty())
+        progressive = true;
+
+    if (distributed && (progressive || adaptive || compare_precision ||
+                        print_stats || !heatmap_path.empty())) {
+        std::cerr << "--workers only renders the default one-shot frame"
+                  << std::endl;
+        return 1;
+    }
+
+    if (streamed && (progressive || adaptive || distributed || frames > 0 ||
+                     !heatmap_path.empty())) {
+        std::cerr << "--memory-budget only renders one-shot frames without "
+                     "a heatmap"
+                  << std::endl;
+        return 1;
+    }
+
+    if (frames > 0 && (progressive || adaptive || compare_precision ||
+                       distributed || print_stats || !heatmap_path.empty())) {
+        std::cerr << "--frames only renders one-shot frames" << std::endl;
+        return 1;
+    }
+
+    if (print_stats || !heatmap_path.empty()) {
+        if (!mini_ray::STATS_ENABLED) {
+            std::cerr << "--stats and --heatmap need a build with "
+                         "MINIRAY_STATS defined"
+                      << std::endl;
+            return 1;
+        }
+
+        options.stats = &render_stats;
+        options.cost_map = !heatmap_path.empty();
+    }
+
+    auto spheres{mini_ray::demo_spheres()};
+
+    // A binary scene is used as built, a text scene replaces the one above
+    bool mapped{false};
+
+    try {
+        if (!scene_path.empty()) {
+            mapped = mini_ray::is_scene_file(scene_path);
+
+            if (!mapped)
+                spheres = mini_ray::read_scene_text<double>(scene_path);
+        }
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    if ((compare_precision || frames > 0) && mapped) {
+        std::cerr << "--compare-precision and --frames need a text scene"
+                  << std::endl;
+        return 1;
+    }
+
+    if (compare_precision) {
+        const auto reference{mini_ray::render_image(spheres, options)};
+        const auto error{mini_ray::image_error(
+            mini_ray::render_image(mini_ray::convert<float>(spheres), options),
+            reference)};
+
+        std::cout << "float vs double: max error " << error.max_abs
+                  << ", mean error " << error.mean_abs << ", "
+                  << error.differing_bytes << " of "
+                  << 3 * reference.pixels.size() << " bytes differ"
+                  << std::endl;
+        return 0;
+    }
+
+    // Move the third sphere sideways from frame to frame, writing each
+    // frame to ./miniray/frame_NNN.ppm
+    const auto animate = [&](auto spheres) {
+        using T = decltype(spheres.front().radius);
+
+        const std::size_t moving{std::min<std::size_t>(2, spheres.size() - 1)};
+        mini_ray::Animation<T> animation{spheres, options};
+
+        for (int frame = 0; frame < frames; ++frame) {
+            if (frame > 0) {
+                auto sphere{animation.spheres()[moving]};
+                sphere.centre.x += static_cast<T>(0.25);
+                animation.update(moving, sphere);
+            }
+
+            char path[64];
+            std::snprintf(path, sizeof(path), "./miniray/frame_%03d.ppm",
+                          frame);
+            write_ppm(animation.render_frame(), path);
+
+            std::cout << "frame " << frame << ": "
+                      << animation.stats().last_traced_tiles << " tiles traced"
+                      << std::endl;
+        }
+
+        const auto &stats{animation.stats()};
+        std::cout << "animation: " << stats.traced_tiles << " tiles traced, "
+                  << stats.reused_tiles << " reused, " << stats.refits
+                  << " refits, " << stats.rebuilds << " rebuilds"
+                  << std::endl;
+    };
+
+    if (frames > 0 && !spheres.empty()) {
+        try {
+            if (single_precision)
+                animate(mini_ray::convert<float>(spheres));
+            else
+                animate(spheres);
+        } catch (const std::exception &error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    const auto output = [&](const auto &scene) {
+        if (adaptive) {
+            mini_ray::AdaptiveStats stats{};
+            write_ppm(mini_ray::render_adaptive(scene, options,
+                                                adaptive_options, &stats),
+                      "./miniray/image.ppm");
+
+            std::cout << "adaptive: " << stats.refined_pixels
+                      << " pixels refined, " << stats.extra_rays
+                      << " extra rays on top of " << stats.base_rays << " ("
+                      << 100.0 * stats.extra_rays / stats.base_rays << "%)"
+                      << std::endl;
+            return;
+        }
+
+        if (distributed)
+            return render_distributed(scene, options, distributed_options);
+
+        if (streamed) {
+            const auto stats{
+                mini_ray::render_streamed(scene, options, stream_options)};
+
+            std::cout << "streamed: " << stats.bands << " bands of "
+                      << stats.band_height << " rows, "
+                      << stats.buffer_bytes << " bytes of buffers"
+                      << std::endl;
+            return;
+        }
+
+        if (!progressive)
+            return render(scene, options);
+
+        mini_ray::ProgressiveStats stats{};
+        auto image{mini_ray::render_progressive(scene, options,
+                                                progressive_options, &stats)};
+
+        if (denoise || !aov_prefix.empty()) {
+            const auto guides{mini_ray::render_guides(
+                scene, options.width, options.height, options.threads)};
+
+            if (denoise)
+                image = mini_ray::denoise(image, guides, denoise_options);
+
+            if (!aov_prefix.empty()) {
+                write_ppm(guides.normal_image(), aov_prefix + "normal.ppm");
+                write_ppm(guides.depth_image(), aov_prefix + "depth.ppm");
+                write_ppm(guides.albedo_image(), aov_prefix + "albedo.ppm");
+            }
+        }
+
+        write_ppm(image, "./miniray/image.ppm");
+
+        std::cout << "progressive: " << stats.passes << " passes, "
+                  << stats.samples << " samples, " << stats.converged_pixels
+                  << " of " << stats.pixels << " pixels converged"
+                  << std::endl;
+    };
+
+    try {
+        if (mapped && single_precision)
+            output(mini_ray::load_scene_file<float>(scene_path));
+        else if (mapped)
+            output(mini_ray::load_scene_file<double>(scene_path));
+        else if (single_precision)
+            output(mini_ray::Scene<float>{mini_ray::convert<float>(spheres),
+                                          accelerator, options.threads});
+        else
+            output(mini_ray::Scene<double>{spheres, accelerator,
+                                           options.threads});
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    if (print_stats) {
+        const auto &rays{render_stats.rays};
+
+        std::cout << "rays: " << rays.primary << " primary, "
+                  << rays.reflection << " reflection, " << rays.refraction
+                  << " refraction, " << rays.shadow << " shadow\n"
+                  << "tests: " << rays.box_tests << " box, "
+                  << rays.sphere_tests << " sphere, " << rays.sphere_hits
+                  << " sphere hits\n"
+                  << "rays per depth:";
+
+        for (auto count : rays.depth) {
+            if (count == 0)
+                break;
+
+            std::cout << ' ' << count;
+        }
+
+        std::cout << std::endl;
+    }
+
+    if (!heatmap_path.empty())
+        write_ppm(mini_ray::cost_heatmap(render_stats.cost, options.width,
+                                         options.height),
+                  heatmap_path);
 
     return 0;
 }
@@ -2,281 +2,257 @@
 #define MINIRAY_HPP
 
 /*
- * A single header ray tracer with very basic functionality.
+ * A header-only ray tracer with very basic functionality.
  * Reference: https://scratchapixel.com
  */
-#include <cmath>
-#include <fstream>
-#include <iostream>
-#include <ostream>
+#include "adaptive.hpp"
+#include "animation.hpp"
+#include "camera.hpp"
+#include "denoise.hpp"
+#include "distributed.hpp"
+#include "frame_writer.hpp"
+#include "framebuffer.hpp"
+#include "image.hpp"
+#include "packet.hpp"
+#include "progressive.hpp"
+#include "random.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "shading.hpp"
+#include "sphere.hpp"
+#include "stats.hpp"
+#include "streaming.hpp"
+#include "thread_pool.hpp"
+#include "tile_renderer.hpp"
+#include "trace.hpp"
+#include "vec3.hpp"
+#include "wavefront.hpp"
+
+#include <utility>
 #include <vector>
 
-const double PI{3.1415926535897932385};
-const double INF{std::numeric_limits<double>::infinity()};
-const int MAX_DEPTH{3};
-
 namespace mini_ray {
 
-template <typename T> class Vec3 {
-  public:
-    T x{}, y{}, z{};
-
-    Vec3() : x{0}, y{0}, z{0} {};
-    explicit Vec3(T x) : x{x}, y{x}, z{x} {};
-    Vec3(T x, T y, T z) : x{x}, y{y}, z{z} {};
-
-    // Operator overloads
-    Vec3<T> operator*(const T &f) const { return Vec3<T>{x * f, y * f, z * f}; }
-    Vec3<T> operator*(const Vec3<T> &v) const {
-        return Vec3<T>{x * v.x, y * v.y, z * v.z};
-    } // For colour scaling
-    Vec3<T> &operator*=(const Vec3<T> &v) {
-        x *= v.x;
-        y *= v.y;
-        z *= v.z;
-
-        return *this;
-    }
-
-    Vec3<T> operator+(const Vec3<T> &v) const {
-        return Vec3<T>{x + v.x, y + v.y, z + v.z};
-    }
-    Vec3<T> &operator+=(const Vec3<T> &v) {
-        x += v.x;
-        y += v.y;
-        z += v.z;
-
-        return *this;
-    }
-
-    Vec3<T> operator-() const { return Vec3<T>{-x, -y, -z}; }
-    Vec3<T> operator-(const Vec3<T> &v) const {
-        return Vec3<T>{x - v.x, y - v.y, z - v.z};
-    }
-
-    // Utility
-    T length_squared() const { return x * x + y * y + z * z; }
-    T length() const { return std::sqrt(length_squared()); }
-    T dot(const Vec3<T> &v) const { return x * v.x + y * v.y + z * v.z; }
-    Vec3<T> normalise() {
-        T normal_squared{length_squared()};
-
-        if (normal_squared > 0) {
-            T inv_normal{1 / sqrt(normal_squared)};
-            // *this *= inv_normal; // POT_ERR
-
-            x *= inv_normal;
-            y *= inv_normal;
-            z *= inv_normal;
-        }
-
-        return *this;
-    }
-    friend std::ostream &operator<<(std::ostream &out, const Vec3<T> &v) {
-        out << "[" << v.x << ' ' << v.y << ' ' << v.z << "]";
-        return out;
-    }
-};
-
-// Common type aliases
-template <typename T> using Point3 = Vec3<T>;
-using Vec3f = Vec3<double>;
-using Point3f = Point3<double>;
-
-class Sphere {
-  public:
-    Point3<double> centre{};
-    double radius{};
-    Vec3f surface_colour{};
-    double reflection{}, transparency{};
-    Vec3f emission_colour{};
-    double radius_squared{};
-
-    Sphere(const Point3f &centre, const double &radius,
-           const Vec3f &surface_colour, const double &reflection = 0,
-           const double &transparency = 0,
-           const Vec3f &emission_colour = Vec3f{})
-        : centre{centre}, radius{radius}, surface_colour{surface_colour},
-          reflection{reflection}, transparency{transparency},
-          emission_colour{emission_colour}, radius_squared{radius * radius} {}
-
-    bool intersect(const Vec3f &ray_orig, const Vec3f &ray_dir, double &t0,
-                   double &t1) const {
-        Vec3f l{centre - ray_orig}; // Distance to sphere centre
-        auto tca{l.dot(ray_dir)};
-
-        if (tca < 0)
-            return false;
-
-        auto d_squared{l.length_squared() - tca * tca};
-
-        if (d_squared > radius_squared)
-            return false;
-
-        auto thc{sqrt(radius_squared - d_squared)};
-        t0 = tca - thc;
-        t1 = tca + thc;
-
-        return true;
-    }
-};
-
-inline double mix(const double &a, const float &b, const float &mix) {
-    return b * mix + a * (1 - mix);
-}
-
-inline Vec3f trace(const Vec3f &ray_orig, const Vec3f &ray_dir,
-                   const std::vector<Sphere> &spheres, const int &depth) {
-    auto t_near{INF};
-    const Sphere *sphere{nullptr};
-
-    // Find ray -> sphere intersection
-    for (const auto &curr_sphere : spheres) {
-        auto t0{INF}, t1{INF};
-
-        auto intersected{curr_sphere.intersect(ray_orig, ray_dir, t0, t1)};
-
-        if (intersected) {
-            if (t0 < 0)
-                t0 = t1;
-
-            if (t0 < t_near) {
-                t_near = t0;
-                sphere = &curr_sphere;
-            }
-        }
-    }
-
-    // No intersection, return background colour
-    if (!sphere)
-        return Vec3f{2};
-
-    Vec3f surface_colour{};
-    Point3f p_hit{ray_orig + ray_dir * t_near}; // Point of intersection
-    Vec3f n_hit{p_hit - sphere->centre};        // Normal at intersection
-    n_hit.normalise();
-
-    double bias{1e-4};
-    bool inside{false};
-
-    // If normal vector is in same direction as ray, we have intersected with
-    // the inside of a sphere. Reverse the direction of the normal and set
-    // inside flag to true.
-    if (ray_dir.dot(n_hit) > 0) {
-        n_hit = -n_hit;
-        inside = true;
-    }
-
-    // Adjust colour based on object transparency and reflectivity properties
-    if ((sphere->transparency > 0 || sphere->reflection > 0) &&
-        depth < MAX_DEPTH) {
-        auto facing_ratio{-ray_dir.dot(n_hit)};
-        double fresnel_effect{mix(std::pow(1 - facing_ratio, 3), 1, 0.1)};
-
-        auto refl_dir{ray_dir - n_hit * 2 * ray_dir.dot(n_hit)};
-        refl_dir.normalise();
-
-        auto reflection{trace(p_hit + n_hit * bias, refl_dir, spheres,
-                              depth + 1)}; // Recursively bounce ray
-        Vec3f refraction{};
-
-        // Calculate refraction ray if sphere is transparent
-        if (sphere->transparency > 0) {
-            double ior{1.1};
-            double eta{inside ? ior : 1 / ior};
-            double cosi{-n_hit.dot(ray_dir)};
-            auto k{1 - (eta * eta) * (1 - (cosi * cosi))};
-
-            auto refr_dir{ray_dir * eta + n_hit * (eta * cosi - sqrt(k))};
-            refr_dir.normalise();
-
-            refraction =
-                trace(p_hit - n_hit * bias, refr_dir, spheres, depth + 1);
-        }
-
-        surface_colour =
-            (reflection * fresnel_effect +
-             refraction * (1 - fresnel_effect) * sphere->transparency) *
-            sphere->surface_colour;
-    } else {
-        // Diffuse object, no need to trace any further
-        for (unsigned int i = 0; i < spheres.size(); ++i) {
-            // Check for light
-            if (spheres[i].emission_colour.x > 0) {
-                Vec3f transmission{1};
-
-                auto light_direction{spheres[i].centre - p_hit};
-                light_direction.normalise();
-
-                // Check light -> world object interactions
-                for (unsigned int j = 0; j < spheres.size(); ++j) {
-                    // Don't compare same sphere
-                    if (i != j) {
-                        double t0{}, t1{};
-
-                        if (spheres[j].intersect(p_hit + n_hit * bias,
-                                                 light_direction, t0, t1)) {
-                            transmission = Vec3f{0};
-
-                            break;
-                        }
-                    }
-                }
-
-                surface_colour += sphere->surface_colour * transmission *
-                                  std::max(static_cast<double>(0),
-                                           n_hit.dot(light_direction)) *
-                                  spheres[i].emission_colour;
-            }
-        }
-    }
-
-    return surface_colour + sphere->emission_colour;
+// The scene the overloads taking spheres render, its BVH built with the
+// threads of the options
+template <typename T>
+Scene<T> build_scene(const std::vector<Sphere<T>> &spheres,
+                     const RenderOptions &options) {
+    return Scene<T>{spheres, Accelerator::automatic, options.threads};
 }
 
 // Compute a ray for each pixel. If the ray hits an object, calculate colour of
 // object at intersection point. Otherwise, return the background colour.
-inline void render(const std::vector<Sphere> &spheres) {
-    int image_width{600}, image_height{480};
-
-    auto *image = new Vec3f[image_width * image_height];
-    Vec3f *pixel = image;
-
-    const double inv_width{1 / static_cast<double>(image_width)},
-        inv_height{1 / static_cast<double>(image_height)};
-
-    const int fov{30};
-    const double aspect_ratio{image_width / static_cast<double>(image_height)};
-    const double look_angle{tan(PI * 0.5 * fov / 180.)};
-
-    // Trace
-    for (int y = 0; y < image_height; ++y) {
-        for (int x = 0; x < image_width; ++x, ++pixel) {
-            double xx{(2 * ((x + 0.5) * inv_width) - 1) * look_angle *
-                      aspect_ratio};
-            double yy{(1 - 2 * ((y + 0.5) * inv_height)) * look_angle};
-
-            Vec3f ray_dir{xx, yy, -1};
-            ray_dir.normalise();
-
-            *pixel = trace(Vec3f{}, ray_dir, spheres, 0);
-        }
-    }
-
-    std::ofstream ofs("./miniray/image.ppm");
-    ofs << "P6\n" << image_width << " " << image_height << "\n255\n";
-
-    for (int i = 0; i < image_width * image_height; ++i) {
-        ofs << static_cast<unsigned char>(
-                   std::min(static_cast<double>(1), image[i].x) * 255)
-            << static_cast<unsigned char>(
-                   std::min(static_cast<double>(1), image[i].y) * 255)
-            << static_cast<unsigned char>(
-                   std::min(static_cast<double>(1), image[i].z) * 255);
-    }
-
-    ofs.close();
-    delete[] image;
+//
+// The image is split into square tiles which are traced in parallel. Every
+// pixel is computed independently, so the result does not depend on the
+// thread count or the order tiles are picked up in.
+//
+// T is the precision everything from scene storage to shading is computed in;
+// render<float> halves the memory traffic and doubles the SIMD width of the
+// intersection kernels at the cost of some accuracy, see image_error().
+//
+// Every function also takes a built Scene, e.g. one loaded with load_scene().
+template <typename T>
+Image<T> render_image(const Scene<T> &scene,
+                      const RenderOptions &options = {}) {
+    TileRenderer<T> renderer{scene, options};
+    Image<T> image{options.width, options.height};
+
+    renderer.render(
+        [&](int x, int y, const Vec3<T> &colour) { image.at(x, y) = colour; });
+
+    return image;
+}
+
+template <typename T>
+Image<T> render_image(const std::vector<Sphere<T>> &spheres,
+                      const RenderOptions &options = {}) {
+    return render_image(build_scene(spheres, options), options);
+}
+
+// Keep sampling until the noise in every pixel is below the threshold of
+// the progressive options or the sample budget runs out
+template <typename T>
+Image<T> render_progressive(const Scene<T> &scene,
+                            const RenderOptions &options = {},
+                            const ProgressiveOptions &progressive = {},
+                            ProgressiveStats *stats = nullptr) {
+    ProgressiveRenderer<T> renderer{scene, options, progressive};
+
+    renderer.run();
+
+    if (stats)
+        *stats = renderer.stats();
+
+    return renderer.image();
+}
+
+template <typename T>
+Image<T> render_progressive(const std::vector<Sphere<T>> &spheres,
+                            const RenderOptions &options = {},
+                            const ProgressiveOptions &progressive = {},
+                            ProgressiveStats *stats = nullptr) {
+    return render_progressive(build_scene(spheres, options), options,
+                              progressive, stats);
+}
+
+// One ray per pixel, plus extra samples where neighbouring pixels contrast
+template <typename T>
+Image<T> render_adaptive(const Scene<T> &scene,
+                         const RenderOptions &options = {},
+                         const AdaptiveOptions &adaptive = {},
+                         AdaptiveStats *stats = nullptr) {
+    AdaptiveRenderer<T> renderer{scene, options, adaptive};
+
+    renderer.run();
+
+    if (stats)
+        *stats = renderer.stats();
+
+    return renderer.image();
+}
+
+template <typename T>
+Image<T> render_adaptive(const std::vector<Sphere<T>> &spheres,
+                         const RenderOptions &options = {},
+                         const AdaptiveOptions &adaptive = {},
+                         AdaptiveStats *stats = nullptr) {
+    return render_adaptive(build_scene(spheres, options), options, adaptive,
+                           stats);
+}
+
+// render_progressive() followed by the denoiser. The guide buffers it was
+// filtered with are returned through guides if given.
+template <typename T>
+Image<T> render_denoised(const Scene<T> &scene,
+                         const RenderOptions &options = {},
+                         const ProgressiveOptions &progressive = {},
+                         const DenoiseOptions &denoise_options = {},
+                         GuideBuffers *guides = nullptr) {
+    const auto image{render_progressive(scene, options, progressive)};
+    auto buffers{render_guides(scene, options.width, options.height,
+                               options.threads)};
+    auto denoised{denoise(image, buffers, denoise_options)};
+
+    if (guides)
+        *guides = std::move(buffers);
+
+    return denoised;
+}
+
+template <typename T>
+Image<T> render_denoised(const std::vector<Sphere<T>> &spheres,
+                         const RenderOptions &options = {},
+                         const ProgressiveOptions &progressive = {},
+                         const DenoiseOptions &denoise_options = {},
+                         GuideBuffers *guides = nullptr) {
+    return render_denoised(build_scene(spheres, options), options, progressive,
+                           denoise_options, guides);
+}
+
+// Render straight to ./miniray/image.ppm. Rows of tiles are written by a
+// separate thread as soon as they are finished, overlapping output with
+// tracing. The frame is held in the pixel format and layout of the options.
+template <typename T>
+void render(const Scene<T> &scene, const RenderOptions &options = {}) {
+    TileRenderer<T> renderer{scene, options};
+    Framebuffer frame{options.width, options.height,
+                      stored_format<T>(options.pixel_format),
+                      options.pixel_layout, renderer.tile_size()};
+    FrameWriter writer{frame, "./miniray/image.ppm", renderer.tile_size()};
+
+    renderer.render(
+        [&](int x, int y, const Vec3<T> &colour) { frame.store(x, y, colour); },
+        [&](const Tile &tile) { writer.tile_done(tile); });
+
+    writer.finish();
+}
+
+template <typename T>
+void render(const std::vector<Sphere<T>> &spheres,
+            const RenderOptions &options = {}) {
+    render(build_scene(spheres, options), options);
+}
+
+// render() for frames that may not fit in memory: bands of rows are traced
+// and written one after another within the memory budget of the stream
+// options, see streaming.hpp
+template <typename T>
+StreamStats render_streamed(const Scene<T> &scene,
+                            const RenderOptions &options = {},
+                            const StreamOptions &stream = {}) {
+    StreamRenderer<T> renderer{scene, options, stream};
+
+    renderer.run();
+
+    return renderer.stats();
+}
+
+template <typename T>
+StreamStats render_streamed(const std::vector<Sphere<T>> &spheres,
+                            const RenderOptions &options = {},
+                            const StreamOptions &stream = {}) {
+    return render_streamed(build_scene(spheres, options), options, stream);
+}
+
+// render() with the tiles traced by worker processes, see distributed.hpp
+template <typename T>
+void render_distributed(const Scene<T> &scene,
+                        const RenderOptions &options = {},
+                        const DistributedOptions &distributed = {}) {
+    // The workers must be forked before the writer thread starts
+    DistributedRenderer<T> renderer{scene, options, distributed};
+    Framebuffer frame{options.width, options.height,
+                      stored_format<T>(options.pixel_format),
+                      options.pixel_layout, renderer.tile_size()};
+    FrameWriter writer{frame, "./miniray/image.ppm", renderer.tile_size()};
+
+    renderer.render(
+        [&](int x, int y, const Vec3<T> &colour) { frame.store(x, y, colour); },
+        [&](const Tile &tile) { writer.tile_done(tile); });
+
+    writer.finish();
+}
+
+template <typename T>
+void render_distributed(const std::vector<Sphere<T>> &spheres,
+                        const RenderOptions &options = {},
+                        const DistributedOptions &distributed = {}) {
+    render_distributed(build_scene(spheres, options), options, distributed);
+}
+
+// The scene main renders unless it is given a scene file
+inline std::vector<Sphere<double>> demo_spheres() {
+    std::vector<Sphere<double>> spheres{};
+
+    spheres.emplace_back(Vec3f{0.0, -10004, -20}, 10000,
+                         Vec3f{0.20, 0.20, 0.20}, 0, 0.0);
+    spheres.emplace_back(Vec3f{0.0, 0, -20}, 4, Vec3f{1.00, 0.32, 0.36}, 1,
+                         0.5);
+    spheres.emplace_back(Vec3f{5.0, -1, -15}, 2, Vec3f{0.90, 0.76, 0.46}, 1,
+                         0.0);
+    spheres.emplace_back(Vec3f{5.0, 0, -25}, 3, Vec3f{0.65, 0.77, 0.97}, 1,
+                         0.0);
+    spheres.emplace_back(Vec3f{-5.5, 0, -15}, 3, Vec3f{0.90, 0.90, 0.90}, 1,
+                         0.0);
+    // light
+    spheres.emplace_back(Vec3f{0.0, 20, -30}, 3, Vec3f{0.00, 0.00, 0.00}, 0,
+                         0.0, Vec3f{3});
+
+    return spheres;
+}
+
+// The same scene at another precision
+template <typename T, typename U>
+std::vector<Sphere<T>> convert(const std::vector<Sphere<U>> &spheres) {
+    std::vector<Sphere<T>> converted{};
+    converted.reserve(spheres.size());
+
+    for (const auto &sphere : spheres)
+        converted.emplace_back(sphere);
+
+    return converted;
 }
 
 } // namespace mini_ray
@@ -0,0 +1,358 @@
+#ifndef MINIRAY_PACKET_HPP
+#define MINIRAY_PACKET_HPP
+
+/*
+ * Packet tracing for rays that share an origin, such as the primary rays of
+ * a block of pixels. A packet walks the BVH once for all of its rays: a node
+ * is entered if any active ray hits its box, and every sphere in a leaf is
+ * tested against all active rays at once. With a shared origin the vector to
+ * the sphere centre is computed once per sphere instead of once per ray.
+ *
+ * Packets only pay off while their rays travel together. A packet whose
+ * direction signs disagree is traced ray by ray from the start, and once
+ * fewer than PACKET_SPLIT_THRESHOLD of its rays reach a node, those rays
+ * finish that subtree as single rays.
+ *
+ * Every ray ends up with exactly the hit a single-ray query would give it.
+ */
+#include "bvh.hpp"
+#include "ray_recorder.hpp"
+#include "scene.hpp"
+#include "simd.hpp"
+#include "sphere_set.hpp"
+#include "stats.hpp"
+#include "vec3.hpp"
+
+#include <array>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+
+namespace mini_ray {
+
+constexpr int PACKET_SPLIT_THRESHOLD{2};
+
+template <typename T> struct RayPacket {
+    static constexpr int WIDTH{4};
+    static constexpr int SIZE{WIDTH * WIDTH};
+    using Mask = std::uint32_t;
+
+    Vec3<T> origin{};
+    alignas(32) T dir_x[SIZE]{};
+    alignas(32) T dir_y[SIZE]{};
+    alignas(32) T dir_z[SIZE]{};
+    Mask active{0}; // Lanes that hold a ray
+    Hit<T> hits[SIZE]{};
+
+    void set(int lane, const Vec3<T> &dir) {
+        dir_x[lane] = dir.x;
+        dir_y[lane] = dir.y;
+        dir_z[lane] = dir.z;
+        hits[lane] = Hit<T>{};
+        active |= Mask{1} << lane;
+    }
+
+    Vec3<T> direction(int lane) const {
+        return Vec3<T>{dir_x[lane], dir_y[lane], dir_z[lane]};
+    }
+
+    // True if all rays agree on the sign of each direction component, which
+    // lets them share one front to back child order
+    bool coherent() const {
+        int positive[3]{0, 0, 0}, count{0};
+
+        for (int lane = 0; lane < SIZE; ++lane) {
+            if (!(active >> lane & 1u))
+                continue;
+
+            positive[0] += !(dir_x[lane] < 0);
+            positive[1] += !(dir_y[lane] < 0);
+            positive[2] += !(dir_z[lane] < 0);
+            ++count;
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (positive[axis] != 0 && positive[axis] != count)
+                return false;
+        }
+
+        return true;
+    }
+
+    static int lane_count(Mask mask) { return std::bitset<SIZE>(mask).count(); }
+};
+
+namespace packet_detail {
+
+template <typename T> using Mask = typename RayPacket<T>::Mask;
+
+// Reciprocal directions for the slab tests, see Bvh::inverse
+template <typename T> struct InverseDirections {
+    alignas(32) T x[RayPacket<T>::SIZE]{};
+    alignas(32) T y[RayPacket<T>::SIZE]{};
+    alignas(32) T z[RayPacket<T>::SIZE]{};
+    alignas(32) T t_max[RayPacket<T>::SIZE]{};
+};
+
+template <typename T>
+Mask<T> box_test_scalar(const Aabb<T> &box, const RayPacket<T> &packet,
+                        const InverseDirections<T> &inv, Mask<T> mask) {
+    Mask<T> result{0};
+
+    for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane) {
+        if ((mask >> lane & 1u) &&
+            box.hit(packet.origin,
+                    Vec3<T>{inv.x[lane], inv.y[lane], inv.z[lane]},
+                    inv.t_max[lane]))
+            result |= Mask<T>{1} << lane;
+    }
+
+    return result;
+}
+
+// Test sphere index against the lanes in mask, offering hits to the scene
+template <typename T>
+void sphere_test_scalar(const Scene<T> &scene, RayPacket<T> &packet,
+                        std::size_t index, Mask<T> mask) {
+    const auto &spheres{scene.spheres()};
+    const T lx{spheres.centre_x()[index] - packet.origin.x};
+    const T ly{spheres.centre_y()[index] - packet.origin.y};
+    const T lz{spheres.centre_z()[index] - packet.origin.z};
+    const T length_squared{lx * lx + ly * ly + lz * lz};
+    const T r2{spheres.radius_squared()[index]};
+
+    for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane) {
+        if (!(mask >> lane & 1u))
+            continue;
+
+        const T tca{lx * packet.dir_x[lane] + ly * packet.dir_y[lane] +
+                    lz * packet.dir_z[lane]};
+
+        if (tca < 0)
+            continue;
+
+        const T d_squared{length_squared - tca * tca};
+
+        if (d_squared > r2)
+            continue;
+
+        const T thc{std::sqrt(r2 - d_squared)};
+        const T t0{tca - thc};
+
+        MINIRAY_COUNT(sphere_hits, 1);
+        scene.offer(packet.hits[lane], index, t0 < 0 ? tca + thc : t0);
+    }
+}
+
+#ifdef MINIRAY_AVX2_KERNEL
+template <typename T>
+__attribute__((target("avx2"))) Mask<T>
+box_test_avx2(const Aabb<T> &box, const RayPacket<T> &packet,
+              const InverseDirections<T> &inv, Mask<T> mask) {
+    using V = Avx2<T>;
+    using Reg = typename V::Reg;
+    constexpr int lanes{static_cast<int>(SIMD_LANES<T>)};
+    constexpr Mask<T> group_mask{(Mask<T>{1} << lanes) - 1};
+
+    const Reg lo[3]{V::set1(box.min.x - packet.origin.x),
+                    V::set1(box.min.y - packet.origin.y),
+                    V::set1(box.min.z - packet.origin.z)};
+    const Reg hi[3]{V::set1(box.max.x - packet.origin.x),
+                    V::set1(box.max.y - packet.origin.y),
+                    V::set1(box.max.z - packet.origin.z)};
+    const T *inv_axis[3]{inv.x, inv.y, inv.z};
+    Mask<T> result{0};
+
+    for (int group = 0; group < RayPacket<T>::SIZE; group += lanes) {
+        if (!(mask >> group & group_mask))
+            continue;
+
+        Reg t_enter{V::zero()};
+        Reg t_exit{V::load(inv.t_max + group)};
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const Reg r{V::load(inv_axis[axis] + group)};
+            const Reg t0{V::mul(lo[axis], r)};
+            const Reg t1{V::mul(hi[axis], r)};
+
+            t_enter = V::max(t_enter, V::min(t0, t1));
+            t_exit = V::min(t_exit, V::max(t0, t1));
+        }
+
+        result |= static_cast<Mask<T>>(V::bits(V::le(t_enter, t_exit)))
+                  << group;
+    }
+
+    return result & mask;
+}
+
+// Same arithmetic, in the same order, as Sphere::intersect
+template <typename T>
+__attribute__((target("avx2"))) void
+sphere_test_avx2(const Scene<T> &scene, RayPacket<T> &packet,
+                 std::size_t index, Mask<T> mask) {
+    using V = Avx2<T>;
+    using Reg = typename V::Reg;
+    constexpr int lanes{static_cast<int>(SIMD_LANES<T>)};
+    constexpr Mask<T> group_mask{(Mask<T>{1} << lanes) - 1};
+
+    const auto &spheres{scene.spheres()};
+    const T lx{spheres.centre_x()[index] - packet.origin.x};
+    const T ly{spheres.centre_y()[index] - packet.origin.y};
+    const T lz{spheres.centre_z()[index] - packet.origin.z};
+    const Reg length_squared{V::set1(lx * lx + ly * ly + lz * lz)};
+    const Reg r2{V::set1(spheres.radius_squared()[index])};
+
+    for (int group = 0; group < RayPacket<T>::SIZE; group += lanes) {
+        if (!(mask >> group & group_mask))
+            continue;
+
+        const Reg tca{
+            V::add(V::add(V::mul(V::set1(lx), V::load(packet.dir_x + group)),
+                          V::mul(V::set1(ly), V::load(packet.dir_y + group))),
+                   V::mul(V::set1(lz), V::load(packet.dir_z + group)))};
+        const Reg d_squared{V::sub(length_squared, V::mul(tca, tca))};
+        const Reg miss{
+            V::either(V::lt(tca, V::zero()), V::gt(d_squared, r2))};
+
+        const auto hit{(static_cast<Mask<T>>(V::bits(miss)) ^ group_mask) &
+                       (mask >> group)};
+
+        if (!(hit & group_mask))
+            continue;
+
+        const Reg thc{V::sqrt(V::sub(r2, d_squared))};
+        const Reg t0{V::sub(tca, thc)};
+        const Reg t1{V::add(tca, thc)};
+        alignas(32) T t[lanes];
+        V::store(t, V::select(t0, t1, V::lt(t0, V::zero())));
+
+        MINIRAY_COUNT(sphere_hits, std::bitset<lanes>(hit).count());
+
+        for (int lane = 0; lane < lanes; ++lane) {
+            if (hit >> lane & 1u)
+                scene.offer(packet.hits[group + lane], index, t[lane]);
+        }
+    }
+}
+#endif
+
+template <typename T>
+Mask<T> box_test(const Aabb<T> &box, const RayPacket<T> &packet,
+                 const InverseDirections<T> &inv, Mask<T> mask) {
+#ifdef MINIRAY_AVX2_KERNEL
+    if (avx2_supported())
+        return box_test_avx2(box, packet, inv, mask);
+#endif
+    return box_test_scalar(box, packet, inv, mask);
+}
+
+template <typename T>
+void sphere_test(const Scene<T> &scene, RayPacket<T> &packet,
+                 std::size_t index, Mask<T> mask) {
+    MINIRAY_COUNT(sphere_tests, RayPacket<T>::lane_count(mask));
+
+#ifdef MINIRAY_AVX2_KERNEL
+    if (avx2_supported())
+        return sphere_test_avx2(scene, packet, index, mask);
+#endif
+    sphere_test_scalar(scene, packet, index, mask);
+}
+
+} // namespace packet_detail
+
+// Find the closest hit of every active ray in the packet
+template <typename T>
+void closest_hit(const Scene<T> &scene, RayPacket<T> &packet) {
+    using Mask = typename RayPacket<T>::Mask;
+    const auto &nodes{scene.bvh().nodes()};
+
+    if (nodes.empty())
+        return;
+
+    const auto single_rays = [&](Mask mask, std::uint32_t root) {
+        for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane) {
+            if (mask >> lane & 1u)
+                scene.closest_hit(packet.origin, packet.direction(lane),
+                                  packet.hits[lane], root);
+        }
+    };
+
+    // The grid walks cells per ray, so packets only help with the BVH
+    if (!packet.coherent() || scene.accelerator() == Accelerator::grid)
+        return single_rays(packet.active, 0);
+
+    packet_detail::InverseDirections<T> inv{};
+    int first_lane{0};
+
+    for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane) {
+        const Vec3<T> r{Bvh<T>::inverse(packet.direction(lane))};
+        inv.x[lane] = r.x;
+        inv.y[lane] = r.y;
+        inv.z[lane] = r.z;
+        inv.t_max[lane] = packet.hits[lane].t;
+    }
+
+    while (!(packet.active >> first_lane & 1u))
+        ++first_lane;
+
+    const bool negative[3]{packet.dir_x[first_lane] < 0,
+                           packet.dir_y[first_lane] < 0,
+                           packet.dir_z[first_lane] < 0};
+
+    struct Entry {
+        std::uint32_t node{};
+        Mask mask{};
+    };
+
+    std::array<Entry, Bvh<T>::STACK_SIZE> stack{};
+    int size{0};
+    Entry entry{0, packet.active};
+
+    while (true) {
+        const auto &node{nodes[entry.node]};
+        const auto mask{packet_detail::box_test(node.bounds, packet, inv,
+                                                entry.mask)};
+
+        MINIRAY_COUNT(box_tests, RayPacket<T>::lane_count(entry.mask));
+
+        if (mask) {
+            if (RayPacket<T>::lane_count(mask) < PACKET_SPLIT_THRESHOLD) {
+                single_rays(mask, entry.node);
+            } else if (node.count > 0) {
+                for (auto i = node.offset; i < node.offset + node.count; ++i)
+                    packet_detail::sphere_test(scene, packet, i, mask);
+            } else {
+                std::uint32_t near{entry.node + 1}, far{node.offset};
+
+                if (negative[node.axis])
+                    std::swap(near, far);
+
+                stack[size++] = Entry{far, mask};
+                entry = Entry{near, mask};
+
+                continue;
+            }
+
+            for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane)
+                inv.t_max[lane] = packet.hits[lane].t;
+        }
+
+        if (size == 0)
+            break;
+
+        entry = stack[--size];
+    }
+
+    if (auto *recorder{thread_ray_recorder<T>()}) {
+        for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane) {
+            if (packet.active >> lane & 1u)
+                recorder->record(packet.origin, packet.direction(lane),
+                                 packet.hits[lane].t);
+        }
+    }
+}
+
+} // namespace mini_ray
+
+#endif
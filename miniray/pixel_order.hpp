@@ -0,0 +1,131 @@
+#ifndef MINIRAY_PIXEL_ORDER_HPP
+#define MINIRAY_PIXEL_ORDER_HPP
+
+/*
+ * Orders in which the pixels of a tile are traced. Every pixel is traced the
+ * same way whatever the order, so the image never changes; what changes is
+ * how similar consecutive rays are. Rays that follow each other closely on
+ * screen visit the same BVH nodes and spheres, keeping them in cache and
+ * making the branches of traversal more predictable.
+ *
+ * - scanline: row by row, as the frame is stored
+ * - tiled: 4x4 blocks, row by row within each block
+ * - morton: along the Z curve, which stays local except at the large jumps
+ *   between quadrants
+ * - hilbert: along the Hilbert curve, whose every step moves to a neighbour
+ *
+ * The curves are laid over the smallest power of two square covering the
+ * grid; cells outside the grid are skipped.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+enum class PixelOrder { scanline, tiled, morton, hilbert };
+
+namespace pixel_order_detail {
+
+constexpr int BLOCK{4}; // Edge of the blocks of the tiled order
+
+// The even bits of v packed together
+inline std::uint32_t compact_bits(std::uint64_t v) {
+    v &= 0x5555555555555555;
+    v = (v | v >> 1) & 0x3333333333333333;
+    v = (v | v >> 2) & 0x0F0F0F0F0F0F0F0F;
+    v = (v | v >> 4) & 0x00FF00FF00FF00FF;
+    v = (v | v >> 8) & 0x0000FFFF0000FFFF;
+
+    return static_cast<std::uint32_t>((v | v >> 16) & 0xFFFFFFFF);
+}
+
+// Cell d along the Hilbert curve through an n x n square, n a power of two
+inline std::pair<int, int> hilbert_cell(int n, std::uint64_t d) {
+    int x{0}, y{0};
+
+    for (int s = 1; s < n; s *= 2) {
+        const int rx{static_cast<int>(d / 2 & 1)};
+        const int ry{static_cast<int>((d ^ static_cast<std::uint64_t>(rx)) &
+                                      1)};
+
+        // Rotate the quadrant so the sub-curves join up
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+
+            std::swap(x, y);
+        }
+
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+
+    return {x, y};
+}
+
+} // namespace pixel_order_detail
+
+// The cells (x, y) of a width x height grid in the given order
+inline std::vector<std::pair<int, int>> pixel_order(PixelOrder order,
+                                                    int width, int height) {
+    using namespace pixel_order_detail;
+
+    std::vector<std::pair<int, int>> cells{};
+    cells.reserve(static_cast<std::size_t>(width) * height);
+
+    const auto keep = [&](int x, int y) {
+        if (x < width && y < height)
+            cells.emplace_back(x, y);
+    };
+
+    switch (order) {
+    case PixelOrder::scanline:
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x)
+                cells.emplace_back(x, y);
+        }
+        break;
+    case PixelOrder::tiled:
+        for (int by = 0; by < height; by += BLOCK) {
+            for (int bx = 0; bx < width; bx += BLOCK) {
+                for (int y = by; y < by + BLOCK; ++y) {
+                    for (int x = bx; x < bx + BLOCK; ++x)
+                        keep(x, y);
+                }
+            }
+        }
+        break;
+    case PixelOrder::morton:
+    case PixelOrder::hilbert: {
+        int n{1};
+
+        while (n < width || n < height)
+            n *= 2;
+
+        const std::uint64_t count{static_cast<std::uint64_t>(n) *
+                                  static_cast<std::uint64_t>(n)};
+
+        for (std::uint64_t d = 0; d < count; ++d) {
+            if (order == PixelOrder::morton) {
+                keep(static_cast<int>(compact_bits(d)),
+                     static_cast<int>(compact_bits(d >> 1)));
+            } else {
+                const auto [x, y]{hilbert_cell(n, d)};
+                keep(x, y);
+            }
+        }
+        break;
+    }
+    }
+
+    return cells;
+}
+
+} // namespace mini_ray
+
+#endif
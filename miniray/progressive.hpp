@@ -0,0 +1,182 @@
+#ifndef MINIRAY_PROGRESSIVE_HPP
+#define MINIRAY_PROGRESSIVE_HPP
+
+/*
+ * Progressive rendering. Every pass traces one more sample through each pixel
+ * that has not converged yet and folds it into a running mean. The first
+ * sample goes through the pixel centre, so a single pass gives the one-shot
+ * image; later samples are jittered across the pixel.
+ *
+ * Per pixel, Welford's algorithm tracks the variance of the displayed
+ * luminance. Once the standard error of the mean falls below the noise
+ * threshold the pixel stops taking samples, tiles with no pixel left to
+ * refine are not scheduled at all, and the frame is done when every pixel
+ * has converged or the sample budget is spent.
+ */
+#include "camera.hpp"
+#include "image.hpp"
+#include "scene.hpp"
+#include "tile_renderer.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+struct ProgressiveOptions {
+    int min_samples{4};  // Taken before a pixel may be judged converged
+    int max_samples{64}; // Per pixel, which also bounds the pass count
+    // Standard error of a pixel's displayed luminance (0 to 1) at which it
+    // counts as converged
+    double noise_threshold{0.002};
+};
+
+struct ProgressiveStats {
+    int passes{0};
+    std::size_t samples{0};          // Primary rays traced over all passes
+    std::size_t converged_pixels{0}; // Pixels that met the noise threshold
+    std::size_t pixels{0};
+};
+
+template <typename T> class ProgressiveRenderer {
+  public:
+    ProgressiveRenderer(const Scene<T> &scene, const RenderOptions &options,
+                        const ProgressiveOptions &progressive = {})
+        : m_renderer{scene, options}, m_progressive{progressive},
+          m_pixels(static_cast<std::size_t>(options.width) * options.height),
+          m_active_per_tile(m_renderer.tile_count()) {
+        for (std::size_t i = 0; i < m_active_per_tile.size(); ++i) {
+            const auto tile{m_renderer.tile(i)};
+            m_active_per_tile[i] = static_cast<std::size_t>(tile.x1 - tile.x0) *
+                                   (tile.y1 - tile.y0);
+        }
+
+        m_stats.pixels = m_pixels.size();
+    }
+
+    bool done() const {
+        return m_stats.converged_pixels == m_stats.pixels ||
+               m_stats.passes >= m_progressive.max_samples;
+    }
+
+    const ProgressiveStats &stats() const { return m_stats; }
+
+    // Take one more sample in every pixel that has not converged and return
+    // how many were taken
+    std::size_t pass() {
+        if (done())
+            return 0;
+
+        m_tiles.clear();
+
+        for (std::size_t i = 0; i < m_active_per_tile.size(); ++i) {
+            if (m_active_per_tile[i] > 0)
+                m_tiles.push_back(i);
+        }
+
+        // Per job (samples, newly converged) so no counter is shared
+        std::vector<std::pair<std::size_t, std::size_t>> counts(m_tiles.size());
+        const auto &camera{m_renderer.camera()};
+        const int sample{m_stats.passes};
+
+        m_renderer.pool().parallel_for(m_tiles.size(), [&](std::size_t job) {
+            auto &[samples, converged]{counts[job]};
+
+            m_renderer.trace(
+                m_renderer.tile(m_tiles[job]),
+                [&](int x, int y) { return !pixel(x, y).converged; },
+                [&](int x, int y) {
+                    const auto [sx, sy]{sample_position(x, y, sample)};
+
+                    return camera.ray(x, y, sx, sy);
+                },
+                [&](int x, int y, const Vec3<T> &colour) {
+                    ++samples;
+                    converged += add_sample(pixel(x, y), colour);
+                });
+
+            m_active_per_tile[m_tiles[job]] -= converged;
+        });
+
+        std::size_t taken{0};
+
+        for (const auto &[samples, converged] : counts) {
+            taken += samples;
+            m_stats.converged_pixels += converged;
+        }
+
+        ++m_stats.passes;
+        m_stats.samples += taken;
+
+        return taken;
+    }
+
+    // Run passes until the frame converges or the budget is spent
+    void run() {
+        while (!done())
+            pass();
+    }
+
+    // The current estimate of every pixel
+    Image<T> image() const {
+        const auto &options{m_renderer.options()};
+        Image<T> image{options.width, options.height};
+
+        for (std::size_t i = 0; i < m_pixels.size(); ++i)
+            image.pixels[i] = Vec3<T>{m_pixels[i].mean};
+
+        return image;
+    }
+
+  private:
+    struct Accumulator {
+        std::uint32_t count{0};
+        bool converged{false};
+        Vec3<double> mean{};
+        double luminance_mean{0}, m2{0}; // Welford state of the luminance
+    };
+
+    TileRenderer<T> m_renderer;
+    ProgressiveOptions m_progressive;
+    std::vector<Accumulator> m_pixels;
+    std::vector<std::size_t> m_active_per_tile; // Unconverged pixels
+    std::vector<std::size_t> m_tiles{};         // Scheduled this pass
+    ProgressiveStats m_stats{};
+
+    Accumulator &pixel(int x, int y) {
+        return m_pixels[static_cast<std::size_t>(y) *
+                            m_renderer.options().width +
+                        x];
+    }
+
+    // Fold a sample in and report whether the pixel has just converged
+    bool add_sample(Accumulator &a, const Vec3<T> &colour) {
+        const Vec3<double> c{colour};
+
+        ++a.count;
+        a.mean += (c - a.mean) * (1.0 / a.count);
+
+        const double l{display_luminance(c)};
+        const double delta{l - a.luminance_mean};
+        a.luminance_mean += delta / a.count;
+        a.m2 += delta * (l - a.luminance_mean);
+
+        if (a.count < static_cast<std::uint32_t>(
+                          std::max(2, m_progressive.min_samples)))
+            return false;
+
+        a.converged = std::sqrt(a.m2 / (a.count - 1) / a.count) <=
+                      m_progressive.noise_threshold;
+
+        return a.converged;
+    }
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef MINIRAY_RANDOM_HPP
+#define MINIRAY_RANDOM_HPP
+
+/*
+ * Counter based random numbers: Philox4x32-10 (Salmon et al., "Parallel
+ * random numbers: as easy as 1, 2, 3", SC 2011). A draw is a pure function of
+ * a 128 bit counter and a 64 bit key, so there is no generator state to share
+ * or to seed per thread. Keying every stream by what is being sampled (pixel,
+ * sample index and bounce) gives the same numbers whichever thread, engine or
+ * order takes the sample, which keeps images reproducible across thread
+ * counts.
+ *
+ * philox_batch() evaluates many counters at once, eight per AVX2 register,
+ * with results identical to philox().
+ */
+#include "simd.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace mini_ray {
+
+using PhiloxCounter = std::array<std::uint32_t, 4>;
+using PhiloxKey = std::array<std::uint32_t, 2>;
+
+namespace random_detail {
+
+constexpr std::uint32_t PHILOX_M0{0xD2511F53}, PHILOX_M1{0xCD9E8D57};
+constexpr std::uint32_t PHILOX_W0{0x9E3779B9}, PHILOX_W1{0xBB67AE85};
+constexpr int PHILOX_ROUNDS{10};
+
+inline void philox_scalar(std::uint32_t &c0, std::uint32_t &c1,
+                          std::uint32_t &c2, std::uint32_t &c3,
+                          PhiloxKey key) {
+    for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+        const std::uint64_t p0{std::uint64_t{PHILOX_M0} * c0};
+        const std::uint64_t p1{std::uint64_t{PHILOX_M1} * c2};
+        const auto hi0{static_cast<std::uint32_t>(p0 >> 32)};
+        const auto hi1{static_cast<std::uint32_t>(p1 >> 32)};
+
+        c0 = hi1 ^ c1 ^ key[0];
+        c1 = static_cast<std::uint32_t>(p1);
+        c2 = hi0 ^ c3 ^ key[1];
+        c3 = static_cast<std::uint32_t>(p0);
+
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+}
+
+#ifdef MINIRAY_AVX2_KERNEL
+// High and low halves of the 32 x 32 bit products of each lane of a with m
+__attribute__((target("avx2"))) inline void
+mul_hi_lo(__m256i a, __m256i m, __m256i &hi, __m256i &lo) {
+    const __m256i even{_mm256_mul_epu32(a, m)};
+    const __m256i odd{_mm256_mul_epu32(_mm256_srli_epi64(a, 32), m)};
+
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+// Eight counters per iteration; returns how many were done
+__attribute__((target("avx2"))) inline std::size_t
+philox_avx2(std::uint32_t *c0, std::uint32_t *c1, std::uint32_t *c2,
+            std::uint32_t *c3, std::size_t count, PhiloxKey key) {
+    const __m256i m0{_mm256_set1_epi32(static_cast<int>(PHILOX_M0))};
+    const __m256i m1{_mm256_set1_epi32(static_cast<int>(PHILOX_M1))};
+    std::size_t i{0};
+
+    for (; i + 8 <= count; i += 8) {
+        const auto at = [i](std::uint32_t *p) {
+            return reinterpret_cast<__m256i *>(p + i);
+        };
+
+        __m256i x0{_mm256_loadu_si256(at(c0))};
+        __m256i x1{_mm256_loadu_si256(at(c1))};
+        __m256i x2{_mm256_loadu_si256(at(c2))};
+        __m256i x3{_mm256_loadu_si256(at(c3))};
+        PhiloxKey k{key};
+
+        for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+            __m256i hi0, lo0, hi1, lo1;
+            mul_hi_lo(x0, m0, hi0, lo0);
+            mul_hi_lo(x2, m1, hi1, lo1);
+
+            x0 = _mm256_xor_si256(
+                _mm256_xor_si256(hi1, x1),
+                _mm256_set1_epi32(static_cast<int>(k[0])));
+            x1 = lo1;
+            x2 = _mm256_xor_si256(
+                _mm256_xor_si256(hi0, x3),
+                _mm256_set1_epi32(static_cast<int>(k[1])));
+            x3 = lo0;
+
+            k[0] += PHILOX_W0;
+            k[1] += PHILOX_W1;
+        }
+
+        _mm256_storeu_si256(at(c0), x0);
+        _mm256_storeu_si256(at(c1), x1);
+        _mm256_storeu_si256(at(c2), x2);
+        _mm256_storeu_si256(at(c3), x3);
+    }
+
+    return i;
+}
+#endif
+
+} // namespace random_detail
+
+inline PhiloxCounter philox(PhiloxCounter counter, PhiloxKey key) {
+    random_detail::philox_scalar(counter[0], counter[1], counter[2],
+                                 counter[3], key);
+
+    return counter;
+}
+
+// Replace each of count counters, given as four arrays of one word each,
+// with its Philox output under key
+inline void philox_batch(std::uint32_t *c0, std::uint32_t *c1,
+                         std::uint32_t *c2, std::uint32_t *c3,
+                         std::size_t count, PhiloxKey key) {
+    std::size_t i{0};
+
+#ifdef MINIRAY_AVX2_KERNEL
+    if (avx2_supported())
+        i = random_detail::philox_avx2(c0, c1, c2, c3, count, key);
+#endif
+    for (; i < count; ++i)
+        random_detail::philox_scalar(c0[i], c1[i], c2[i], c3[i], key);
+}
+
+// Uniform value in [0, 1) from 32 random bits (float) or 64 (double)
+template <typename T> T to_uniform(std::uint32_t a, std::uint32_t b = 0);
+
+template <> inline float to_uniform<float>(std::uint32_t a, std::uint32_t) {
+    return static_cast<float>(a >> 8) * 0x1p-24f;
+}
+
+template <>
+inline double to_uniform<double>(std::uint32_t a, std::uint32_t b) {
+    return static_cast<double>((std::uint64_t{a} << 32 | b) >> 11) * 0x1p-53;
+}
+
+// The numbers of one sample of one pixel at one bounce. The stream is a
+// sequence of Philox blocks with counter (x, y, sample, bounce << 16 |
+// block), so a stream holds up to 2^18 words, and the key separates whole
+// sequences of images (e.g. frames or seeds).
+class Rng {
+  public:
+    Rng(std::uint32_t x, std::uint32_t y, std::uint32_t sample,
+        std::uint32_t bounce = 0, std::uint64_t key = 0)
+        : m_counter{x, y, sample, bounce << 16},
+          m_key{static_cast<std::uint32_t>(key),
+                static_cast<std::uint32_t>(key >> 32)} {}
+
+    std::uint32_t next() {
+        if (m_used == 4) {
+            m_block = philox(m_counter, m_key);
+            ++m_counter[3];
+            m_used = 0;
+        }
+
+        return m_block[m_used++];
+    }
+
+    template <typename T = double> T uniform() {
+        const std::uint32_t a{next()};
+
+        if constexpr (sizeof(T) > sizeof(std::uint32_t))
+            return to_uniform<T>(a, next());
+        else
+            return to_uniform<T>(a);
+    }
+
+    // count more words of the stream, the same as calling next() count
+    // times, generated a batch of blocks at a time
+    void fill(std::uint32_t *out, std::size_t count) {
+        while (count > 0 && m_used < 4) {
+            *out++ = next();
+            --count;
+        }
+
+        constexpr std::size_t BATCH{32}; // Blocks
+        std::uint32_t c[4][BATCH];
+
+        while (count >= 4) {
+            const std::size_t blocks{std::min(BATCH, count / 4)};
+
+            for (std::size_t i = 0; i < blocks; ++i) {
+                c[0][i] = m_counter[0];
+                c[1][i] = m_counter[1];
+                c[2][i] = m_counter[2];
+                c[3][i] = m_counter[3]++;
+            }
+
+            philox_batch(c[0], c[1], c[2], c[3], blocks, m_key);
+
+            for (std::size_t i = 0; i < blocks; ++i) {
+                for (int word = 0; word < 4; ++word)
+                    *out++ = c[word][i];
+            }
+
+            count -= 4 * blocks;
+        }
+
+        for (; count > 0; --count)
+            *out++ = next();
+    }
+
+  private:
+    PhiloxCounter m_counter;
+    PhiloxKey m_key;
+    PhiloxCounter m_block{};
+    int m_used{4}; // Words of m_block handed out
+};
+
+} // namespace mini_ray
+
+#endif
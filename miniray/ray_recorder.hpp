@@ -0,0 +1,54 @@
+#ifndef MINIRAY_RAY_RECORDER_HPP
+#define MINIRAY_RAY_RECORDER_HPP
+
+/*
+ * A hook for observing the rays a thread traces. While a recorder is
+ * installed for the calling thread, every scene query reports the segment
+ * of space its ray covered: from the origin to the hit that ended it, or
+ * without end for rays that escape and for unoccluded shadow rays. Used by
+ * the animation code to find out which tiles a change in the scene can
+ * reach (see animation.hpp). With no recorder installed a query only pays
+ * for one thread local load.
+ */
+#include "vec3.hpp"
+
+namespace mini_ray {
+
+template <typename T> class RayRecorder {
+  public:
+    // The ray covered ray_orig + t * ray_dir for t in [0, t_end]; t_end is
+    // infinite when nothing stopped it
+    virtual void record(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                        T t_end) = 0;
+
+  protected:
+    ~RayRecorder() = default;
+};
+
+// The recorder of the calling thread, or nullptr
+template <typename T> RayRecorder<T> *&thread_ray_recorder() {
+    thread_local RayRecorder<T> *recorder{nullptr};
+
+    return recorder;
+}
+
+// Install a recorder for the calling thread for the lifetime of the guard
+template <typename T> class RecordRays {
+  public:
+    explicit RecordRays(RayRecorder<T> &recorder)
+        : m_previous{thread_ray_recorder<T>()} {
+        thread_ray_recorder<T>() = &recorder;
+    }
+
+    RecordRays(const RecordRays &) = delete;
+    RecordRays &operator=(const RecordRays &) = delete;
+
+    ~RecordRays() { thread_ray_recorder<T>() = m_previous; }
+
+  private:
+    RayRecorder<T> *m_previous;
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef MINIRAY_SCENE_HPP
+#define MINIRAY_SCENE_HPP
+
+/*
+ * The spheres of a scene together with the acceleration structure used to
+ * query them. Spheres are stored in BVH leaf order, so an index into the
+ * scene is not the index the sphere had in the vector it was built from;
+ * input_order() maps back where the original order matters.
+ *
+ * Queries go through the BVH or, for dense sets of similar sized spheres,
+ * a uniform grid (see grid.hpp). Both give the same answers; the BVH is
+ * built either way, as it fixes the storage order and is what packets and
+ * scene files use.
+ *
+ * A scene can also be assembled from parts built earlier, which is how scene
+ * files are loaded without rebuilding (see scene_file.hpp).
+ */
+#include "bvh.hpp"
+#include "grid.hpp"
+#include "lights.hpp"
+#include "ray_recorder.hpp"
+#include "sphere.hpp"
+#include "sphere_set.hpp"
+#include "stats.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+// Result of a closest hit query
+template <typename T> struct Hit {
+    static constexpr std::size_t NONE{std::numeric_limits<std::size_t>::max()};
+
+    T t{std::numeric_limits<T>::infinity()}; // Distance along the ray
+    std::size_t index{NONE}; // Scene index of the sphere hit
+
+    bool found() const { return index != NONE; }
+};
+
+template <typename T> class Scene {
+  public:
+    // threads builds the BVH of a large scene in parallel, 0 using every
+    // hardware thread
+    explicit Scene(const std::vector<Sphere<T>> &spheres,
+                   Accelerator accelerator = Accelerator::automatic,
+                   unsigned int threads = 0) {
+        std::vector<Aabb<T>> bounds{};
+        bounds.reserve(spheres.size());
+
+        for (const auto &sphere : spheres)
+            bounds.push_back(sphere_bounds(sphere));
+
+        if (threads != 1 && bounds.size() >= Bvh<T>::PARALLEL_MIN) {
+            ThreadPool pool{threads};
+            m_bvh = Bvh<T>{bounds, &pool};
+        } else {
+            m_bvh = Bvh<T>{bounds};
+        }
+
+        m_spheres.reserve(spheres.size());
+
+        auto &input_order{m_input_order.owned()};
+        input_order.resize(spheres.size());
+
+        for (auto index : m_bvh.order()) {
+            input_order[index] = m_spheres.size();
+            m_spheres.push_back(spheres[index]);
+        }
+
+        m_lights = LightList<T>{m_spheres, m_input_order};
+
+        if (accelerator == Accelerator::automatic)
+            accelerator = choose_accelerator(bounds);
+
+        if (accelerator == Accelerator::grid)
+            build_grid();
+    }
+
+    // Parts that may borrow memory; owner keeps that memory alive for as
+    // long as the scene exists
+    Scene(SphereSet<T> spheres, Bvh<T> bvh, Storage<std::size_t> input_order,
+          LightList<T> lights, std::shared_ptr<const void> owner = {})
+        : m_spheres{std::move(spheres)}, m_input_order{std::move(input_order)},
+          m_bvh{std::move(bvh)}, m_lights{std::move(lights)},
+          m_owner{std::move(owner)} {}
+
+    const SphereSet<T> &spheres() const { return m_spheres; }
+    // Scene index of each sphere, listed in the order they were given
+    const Storage<std::size_t> &input_order() const {
+        return m_input_order;
+    }
+    const Bvh<T> &bvh() const { return m_bvh; }
+    const LightList<T> &lights() const { return m_lights; }
+    // Move the spheres to where spheres, listed as the scene was built from
+    // them, now are, without building a new BVH: sphere data is replaced in
+    // place and the BVH refitted (see Bvh::refit). The grid, when used, is
+    // rebuilt, which costs about as much as a refit. Scenes borrowed from a
+    // file cannot be refitted.
+    void refit(const std::vector<Sphere<T>> &spheres) {
+        if (m_bvh.nodes().borrowed())
+            throw std::invalid_argument{
+                "a scene loaded from a file cannot be refitted"};
+
+        if (spheres.size() != m_spheres.size())
+            throw std::invalid_argument{
+                "a scene must be refitted to as many spheres as it was built "
+                "from"};
+
+        std::vector<Aabb<T>> bounds{};
+        bounds.reserve(spheres.size());
+
+        for (std::size_t i = 0; i < spheres.size(); ++i) {
+            m_spheres.set(m_input_order[i], spheres[i]);
+            bounds.push_back(sphere_bounds(spheres[i]));
+        }
+
+        m_bvh.refit(bounds);
+        m_lights = LightList<T>{m_spheres, m_input_order};
+
+        if (m_grid)
+            build_grid();
+    }
+
+    // Either bvh or grid, never automatic
+    Accelerator accelerator() const {
+        return m_grid ? Accelerator::grid : Accelerator::bvh;
+    }
+
+    // Nearest sphere along the ray, using the same rules as a linear scan
+    // with Sphere::intersect: a ray starting inside a sphere hits its far
+    // side, and of two hits at the same distance the one given first wins.
+    // A candidate already held in hit competes under the same rules, and
+    // root restricts the search to one subtree of the BVH (it is ignored
+    // when the grid answers queries).
+    bool closest_hit(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                     Hit<T> &hit, std::uint32_t root = 0) const {
+        if (m_grid) {
+            m_grid->closest(ray_orig, ray_dir, hit.t,
+                            [&](const std::uint32_t *items,
+                                std::uint32_t count, T &) {
+                                closest_in_list(items, count, ray_orig,
+                                                ray_dir, hit);
+                            });
+        } else {
+            closest_in_bvh(ray_orig, ray_dir, hit, root);
+        }
+
+        if (auto *recorder{thread_ray_recorder<T>()})
+            recorder->record(ray_orig, ray_dir, hit.t);
+
+        return hit.found();
+    }
+
+    // Keep a candidate if it beats the current hit
+    void offer(Hit<T> &hit, std::size_t index, T t) const {
+        if (t < hit.t ||
+            (t == hit.t && hit.found() && given_before(index, hit.index))) {
+            hit.t = t;
+            hit.index = index;
+        }
+    }
+
+    // True if any sphere other than the one at index skip intersects the
+    // ray. Like Sphere::intersect this is not limited to a distance, so
+    // spheres behind a light still cast a shadow.
+    bool occluded(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                  std::size_t skip) const {
+        MINIRAY_COUNT(shadow, 1);
+
+        T t_end{std::numeric_limits<T>::infinity()};
+        const bool blocked{
+            m_grid ? m_grid->any(ray_orig, ray_dir,
+                                 [&](const std::uint32_t *items,
+                                     std::uint32_t count) {
+                                     return any_in_list(items, count,
+                                                        ray_orig, ray_dir,
+                                                        skip, t_end);
+                                 })
+                   : any_in_bvh(ray_orig, ray_dir, skip, t_end)};
+
+        if (auto *recorder{thread_ray_recorder<T>()})
+            recorder->record(ray_orig, ray_dir, t_end);
+
+        return blocked;
+    }
+
+  private:
+    static constexpr std::size_t LANES{SphereSet<T>::LANES};
+
+    SphereSet<T> m_spheres{};
+    Storage<std::size_t> m_input_order{};
+    Bvh<T> m_bvh{};
+    LightList<T> m_lights{};
+    std::shared_ptr<const void> m_owner{};
+    std::shared_ptr<const UniformGrid<T>> m_grid{}; // Set when it is used
+
+    void closest_in_bvh(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                        Hit<T> &hit, std::uint32_t root) const {
+        m_bvh.closest(
+            ray_orig, ray_dir, hit.t,
+            [&](std::uint32_t first, std::uint32_t count, T &) {
+                const std::size_t last{first + count};
+
+                for (std::size_t i = first; i < last; i += LANES) {
+                    T t[LANES];
+                    const auto mask{m_spheres.intersect(i, ray_orig, ray_dir,
+                                                        t) &
+                                    SphereSet<T>::lane_mask(i, last)};
+
+                    MINIRAY_COUNT(sphere_tests, std::min(LANES, last - i));
+                    MINIRAY_COUNT(sphere_hits, std::bitset<32>(mask).count());
+
+                    for (std::size_t lane = 0; mask >> lane; ++lane) {
+                        if (mask >> lane & 1u)
+                            offer(hit, i + lane, t[lane]);
+                    }
+                }
+            },
+            root);
+    }
+
+    void closest_in_list(const std::uint32_t *items, std::uint32_t count,
+                         const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                         Hit<T> &hit) const {
+        for (std::uint32_t i = 0; i < count; i += LANES) {
+            T t[LANES];
+            const auto mask{
+                m_spheres.intersect(items + i, ray_orig, ray_dir, t) &
+                SphereSet<T>::lane_mask(i, count)};
+
+            MINIRAY_COUNT(sphere_tests,
+                          std::min<std::size_t>(LANES, count - i));
+            MINIRAY_COUNT(sphere_hits, std::bitset<32>(mask).count());
+
+            for (std::size_t lane = 0; mask >> lane; ++lane) {
+                if (mask >> lane & 1u)
+                    offer(hit, items[i + lane], t[lane]);
+            }
+        }
+    }
+
+    bool any_in_bvh(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                    std::size_t skip, T &t_end) const {
+        return m_bvh.any(
+            ray_orig, ray_dir, [&](std::uint32_t first, std::uint32_t count) {
+                const std::size_t last{first + count};
+
+                for (std::size_t i = first; i < last; i += LANES) {
+                    T t[LANES];
+                    auto mask{m_spheres.intersect(i, ray_orig, ray_dir, t) &
+                              SphereSet<T>::lane_mask(i, last)};
+
+                    if (skip >= i && skip < i + LANES)
+                        mask &= ~(1u << (skip - i));
+
+                    MINIRAY_COUNT(sphere_tests, std::min(LANES, last - i));
+                    MINIRAY_COUNT(sphere_hits, std::bitset<32>(mask).count());
+
+                    if (mask) {
+                        t_end = t[__builtin_ctz(mask)];
+                        return true;
+                    }
+                }
+
+                return false;
+            });
+    }
+
+    bool any_in_list(const std::uint32_t *items, std::uint32_t count,
+                     const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                     std::size_t skip, T &t_end) const {
+        for (std::uint32_t i = 0; i < count; i += LANES) {
+            T t[LANES];
+            auto mask{m_spheres.intersect(items + i, ray_orig, ray_dir, t) &
+                      SphereSet<T>::lane_mask(i, count)};
+
+            for (std::size_t lane = 0; lane < LANES; ++lane) {
+                if (items[i + lane] == skip)
+                    mask &= ~(1u << lane);
+            }
+
+            MINIRAY_COUNT(sphere_tests,
+                          std::min<std::size_t>(LANES, count - i));
+            MINIRAY_COUNT(sphere_hits, std::bitset<32>(mask).count());
+
+            if (mask) {
+                t_end = t[__builtin_ctz(mask)];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Over the spheres in scene order, which the grid lists refer to
+    void build_grid() {
+        std::vector<Aabb<T>> bounds{};
+        bounds.reserve(m_spheres.size());
+
+        for (std::size_t i = 0; i < m_spheres.size(); ++i)
+            bounds.push_back(sphere_bounds(m_spheres[i]));
+
+        m_grid = std::make_shared<const UniformGrid<T>>(bounds);
+    }
+
+    bool given_before(std::size_t index, std::size_t other) const {
+        return m_bvh.order()[index] < m_bvh.order()[other];
+    }
+
+    // Sphere bounds padded slightly so that rounding in the slab test can
+    // never cull a grazing hit the exact intersection test would report. The
+    // relative padding grows with the rounding error of T.
+    static Aabb<T> sphere_bounds(const Sphere<T> &sphere) {
+        const T scale{std::max(static_cast<T>(1e-9),
+                               64 * std::numeric_limits<T>::epsilon())};
+        const auto &c{sphere.centre};
+        const T pad{
+            sphere.radius * scale +
+            scale * std::max({std::abs(c.x), std::abs(c.y), std::abs(c.z)})};
+        const Vec3<T> extent{sphere.radius + pad};
+
+        return Aabb<T>{c - extent, c + extent};
+    }
+};
+
+} // namespace mini_ray
+
+#endif
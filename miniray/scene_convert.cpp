@@ -0,0 +1,77 @@
+/*
+ * Converts a text scene to the binary format main loads with --scene, and
+ * reports how long each step takes next to the time it takes to map the
+ * result back in.
+ */
+#include "scene_file.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <typename T>
+void convert(const std::string &input, const std::string &output) {
+    auto start{Clock::now()};
+    const auto spheres{mini_ray::read_scene_text<T>(input)};
+    const double parse{seconds_since(start)};
+
+    start = Clock::now();
+    const mini_ray::Scene<T> scene{spheres};
+    const double build{seconds_since(start)};
+
+    start = Clock::now();
+    mini_ray::write_scene_file(scene, output);
+    const double write{seconds_since(start)};
+
+    start = Clock::now();
+    const auto loaded{mini_ray::load_scene_file<T>(output)};
+    const double load{seconds_since(start)};
+
+    std::cout << spheres.size() << " spheres, " << scene.bvh().nodes().size()
+              << " nodes: parsed in " << parse << " s, built in " << build
+              << " s, written in " << write << " s, mapped back in " << load
+              << " s" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+    bool single_precision{false};
+    int first{1};
+
+    if (argc > 2 && std::strcmp(argv[1], "--precision") == 0 &&
+        (std::strcmp(argv[2], "float") == 0 ||
+         std::strcmp(argv[2], "double") == 0)) {
+        single_precision = std::strcmp(argv[2], "float") == 0;
+        first = 3;
+    }
+
+    if (argc - first != 2) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--precision float|double] INPUT.txt OUTPUT.scene"
+                  << std::endl;
+        return 1;
+    }
+
+    try {
+        if (single_precision)
+            convert<float>(argv[first], argv[first + 1]);
+        else
+            convert<double>(argv[first], argv[first + 1]);
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
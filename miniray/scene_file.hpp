@@ -0,0 +1,374 @@
+#ifndef MINIRAY_SCENE_FILE_HPP
+#define MINIRAY_SCENE_FILE_HPP
+
+/*
+ * Scene files. The text format lists one sphere per line:
+ *
+ *     cx cy cz radius r g b [reflection [transparency [er eg eb]]]
+ *
+ * with '#' starting a comment. Parsing it and building the BVH takes
+ * seconds for millions of spheres, so a built scene can also be saved in a
+ * binary format that is a dump of its arrays: the SoA sphere blocks, the
+ * materials, the BVH nodes and the light list, each section aligned to 64
+ * bytes. Loading maps the file and lets the scene borrow the sections in
+ * place, so nothing is parsed, copied or rebuilt and pages are only read
+ * from disk once a ray touches them.
+ *
+ * The binary format is tied to the precision, the SIMD width and the byte
+ * order it was written with; the header records all three and a mismatch is
+ * rejected rather than converted. The arrays themselves are trusted, so only
+ * load files written by write_scene_file().
+ */
+#include "bvh.hpp"
+#include "lights.hpp"
+#include "scene.hpp"
+#include "sphere.hpp"
+#include "sphere_set.hpp"
+#include "storage.hpp"
+#include "vec3.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace mini_ray {
+
+// Sections holding indices are written as 64 bit integers
+static_assert(sizeof(std::size_t) == 8);
+
+inline constexpr char SCENE_FILE_MAGIC[8]{'M', 'I', 'N', 'I',
+                                          'R', 'A', 'Y', '\0'};
+inline constexpr std::uint32_t SCENE_FILE_VERSION{1};
+inline constexpr std::uint32_t SCENE_FILE_BYTE_ORDER{0x01020304};
+inline constexpr std::uint64_t SCENE_FILE_ALIGNMENT{64};
+
+struct SceneFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;    // SCENE_FILE_BYTE_ORDER as the writer saw it
+    std::uint32_t scalar_size;   // sizeof(T)
+    std::uint32_t lanes;         // SphereSet<T>::LANES
+    std::uint32_t material_size; // sizeof(SphereMaterial<T>)
+    std::uint32_t node_size;     // sizeof(BvhNode<T>)
+    std::uint64_t sphere_count, capacity, node_count, light_count;
+
+    // Byte offsets of the sections from the start of the file
+    std::uint64_t hot_offset;         // 4 * (capacity + lanes) scalars
+    std::uint64_t material_offset;    // sphere_count materials
+    std::uint64_t node_offset;        // node_count nodes
+    std::uint64_t order_offset;       // sphere_count uint32, Bvh::order()
+    std::uint64_t input_order_offset; // sphere_count uint64
+    std::uint64_t light_offset;       // light_count uint64 indices
+    std::uint64_t cdf_offset;         // light_count doubles
+    std::uint64_t file_size;
+};
+
+// A whole file mapped read only
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path) {
+        const int fd{::open(path.c_str(), O_RDONLY)};
+
+        if (fd < 0)
+            throw std::system_error{errno, std::generic_category(),
+                                    "cannot open " + path};
+
+        struct stat info {};
+
+        if (::fstat(fd, &info) != 0) {
+            const int error{errno};
+            ::close(fd);
+            throw std::system_error{error, std::generic_category(),
+                                    "cannot stat " + path};
+        }
+
+        m_size = static_cast<std::size_t>(info.st_size);
+
+        if (m_size > 0) {
+            void *data{::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+
+            if (data == MAP_FAILED) {
+                const int error{errno};
+                ::close(fd);
+                throw std::system_error{error, std::generic_category(),
+                                        "cannot map " + path};
+            }
+
+            m_data = static_cast<const unsigned char *>(data);
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (m_data)
+            ::munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+
+    const unsigned char *data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+  private:
+    const unsigned char *m_data{nullptr};
+    std::size_t m_size{0};
+};
+
+namespace scene_file_detail {
+
+inline std::uint64_t align(std::uint64_t offset) {
+    return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT *
+           SCENE_FILE_ALIGNMENT;
+}
+
+// Append count elements at data as the next section, returning its offset
+template <typename E>
+std::uint64_t write_section(std::ofstream &ofs, std::uint64_t &end,
+                            const E *data, std::size_t count) {
+    static_assert(std::is_trivially_copyable_v<E>);
+    static const char padding[SCENE_FILE_ALIGNMENT]{};
+
+    const std::uint64_t offset{align(end)};
+
+    ofs.write(padding, static_cast<std::streamsize>(offset - end));
+    ofs.write(reinterpret_cast<const char *>(data),
+              static_cast<std::streamsize>(count * sizeof(E)));
+    end = offset + count * sizeof(E);
+
+    return offset;
+}
+
+// The count elements of a section, checked to lie inside the file
+template <typename E>
+const E *section(const MappedFile &file, std::uint64_t offset,
+                 std::uint64_t count) {
+    if (offset % SCENE_FILE_ALIGNMENT != 0 || offset > file.size() ||
+        count > (file.size() - offset) / sizeof(E))
+        throw std::runtime_error{"scene file section out of bounds"};
+
+    return reinterpret_cast<const E *>(file.data() + offset);
+}
+
+} // namespace scene_file_detail
+
+// Save a built scene in the binary format
+template <typename T>
+void write_scene_file(const Scene<T> &scene, const std::string &path) {
+    using namespace scene_file_detail;
+
+    const auto &spheres{scene.spheres()};
+    const auto &nodes{scene.bvh().nodes()};
+    const auto &lights{scene.lights()};
+
+    SceneFileHeader header{};
+    std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.byte_order = SCENE_FILE_BYTE_ORDER;
+    header.scalar_size = sizeof(T);
+    header.lanes = SphereSet<T>::LANES;
+    header.material_size = sizeof(SphereMaterial<T>);
+    header.node_size = sizeof(BvhNode<T>);
+    header.sphere_count = spheres.size();
+    header.capacity = spheres.capacity();
+    header.node_count = nodes.size();
+    header.light_count = lights.indices().size();
+
+    std::ofstream ofs(path, std::ios::binary);
+
+    if (!ofs)
+        throw std::runtime_error{"cannot create " + path};
+
+    // A placeholder header, rewritten once the section offsets are known
+    std::uint64_t end{sizeof(header)};
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    if (!spheres.empty())
+        header.hot_offset = write_section(
+            ofs, end, spheres.hot(), 4 * (spheres.capacity() + header.lanes));
+
+    header.material_offset = write_section(
+        ofs, end, spheres.materials().data(), spheres.materials().size());
+    header.node_offset = write_section(ofs, end, nodes.data(), nodes.size());
+    header.order_offset = write_section(
+        ofs, end, scene.bvh().order().data(), scene.bvh().order().size());
+    header.input_order_offset = write_section(
+        ofs, end, scene.input_order().data(), scene.input_order().size());
+    header.light_offset = write_section(ofs, end, lights.indices().data(),
+                                        lights.indices().size());
+    header.cdf_offset =
+        write_section(ofs, end, lights.cdf().data(), lights.cdf().size());
+    header.file_size = end;
+
+    ofs.seekp(0);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.close();
+
+    if (!ofs)
+        throw std::runtime_error{"cannot write " + path};
+}
+
+// Whether the file starts like a binary scene file
+inline bool is_scene_file(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[sizeof(SCENE_FILE_MAGIC)]{};
+
+    return ifs.read(magic, sizeof(magic)) &&
+           std::memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+// Map a binary scene file. The scene borrows the mapping, which is released
+// together with the last copy of the scene's parts.
+template <typename T> Scene<T> load_scene_file(const std::string &path) {
+    using namespace scene_file_detail;
+
+    auto file{std::make_shared<const MappedFile>(path)};
+    SceneFileHeader header{};
+
+    if (file->size() < sizeof(header))
+        throw std::runtime_error{path + " is not a scene file"};
+
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)))
+        throw std::runtime_error{path + " is not a scene file"};
+    if (header.version != SCENE_FILE_VERSION)
+        throw std::runtime_error{path + " has unsupported version " +
+                                 std::to_string(header.version)};
+    if (header.byte_order != SCENE_FILE_BYTE_ORDER)
+        throw std::runtime_error{path + " was written with another byte order"};
+    if (header.scalar_size != sizeof(T))
+        throw std::runtime_error{
+            path + " holds " +
+            (header.scalar_size == sizeof(float) ? "float" : "double") +
+            " precision data"};
+    if (header.lanes != SphereSet<T>::LANES ||
+        header.material_size != sizeof(SphereMaterial<T>) ||
+        header.node_size != sizeof(BvhNode<T>))
+        throw std::runtime_error{path +
+                                 " was written by an incompatible build"};
+    if (header.file_size != file->size() ||
+        header.capacity < header.sphere_count ||
+        header.capacity % header.lanes != 0 ||
+        header.sphere_count > std::numeric_limits<std::uint32_t>::max())
+        throw std::runtime_error{path + " is truncated or corrupt"};
+
+    const std::size_t count{header.sphere_count};
+    SphereSet<T> spheres{};
+
+    if (count > 0)
+        spheres = SphereSet<T>::borrow(
+            section<T>(*file, header.hot_offset,
+                       4 * (header.capacity + header.lanes)),
+            count, header.capacity,
+            section<SphereMaterial<T>>(*file, header.material_offset, count));
+    Bvh<T> bvh{
+        Storage<BvhNode<T>>::borrow(section<BvhNode<T>>(*file,
+                                                        header.node_offset,
+                                                        header.node_count),
+                                    header.node_count),
+        Storage<std::uint32_t>::borrow(
+            section<std::uint32_t>(*file, header.order_offset, count), count)};
+    auto input_order{Storage<std::size_t>::borrow(
+        section<std::size_t>(*file, header.input_order_offset, count), count)};
+    LightList<T> lights{
+        Storage<std::size_t>::borrow(
+            section<std::size_t>(*file, header.light_offset,
+                                 header.light_count),
+            header.light_count),
+        Storage<double>::borrow(
+            section<double>(*file, header.cdf_offset, header.light_count),
+            header.light_count)};
+
+    return Scene<T>{std::move(spheres), std::move(bvh), std::move(input_order),
+                    std::move(lights), std::move(file)};
+}
+
+// Parse the text format
+template <typename T>
+std::vector<Sphere<T>> read_scene_text(const std::string &path) {
+    std::ifstream ifs(path);
+
+    if (!ifs)
+        throw std::runtime_error{"cannot open " + path};
+
+    std::vector<Sphere<T>> spheres{};
+    std::string line{};
+
+    for (int number = 1; std::getline(ifs, line); ++number) {
+        const auto comment{line.find('#')};
+        const char *p{line.data()};
+        const char *end{p + (comment == std::string::npos ? line.size()
+                                                          : comment)};
+        T values[12]{};
+        int count{0};
+
+        for (;;) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                ++p;
+
+            if (p == end)
+                break;
+
+            if (count == 12)
+                throw std::runtime_error{path + ":" + std::to_string(number) +
+                                         ": too many values"};
+
+            const auto [next, error]{std::from_chars(p, end, values[count])};
+
+            if (error != std::errc{})
+                throw std::runtime_error{path + ":" + std::to_string(number) +
+                                         ": bad number"};
+
+            p = next;
+            ++count;
+        }
+
+        if (count == 0)
+            continue;
+
+        if (count < 7 || count == 10 || count == 11)
+            throw std::runtime_error{path + ":" + std::to_string(number) +
+                                     ": expected cx cy cz radius r g b"
+                                     " [reflection [transparency"
+                                     " [er eg eb]]]"};
+
+        spheres.emplace_back(Point3<T>{values[0], values[1], values[2]},
+                             values[3],
+                             Vec3<T>{values[4], values[5], values[6]},
+                             values[7], values[8],
+                             Vec3<T>{values[9], values[10], values[11]});
+    }
+
+    return spheres;
+}
+
+// A text or binary scene file, told apart by the magic
+template <typename T> Scene<T> load_scene(const std::string &path) {
+    if (is_scene_file(path))
+        return load_scene_file<T>(path);
+
+    return Scene<T>{read_scene_text<T>(path)};
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef MINIRAY_SHADING_HPP
+#define MINIRAY_SHADING_HPP
+
+/*
+ * The shading rules of the renderer, split into the steps every engine goes
+ * through at a hit: surface geometry, the reflection and refraction rays of
+ * shiny surfaces, and direct light on diffuse ones. Keeping the arithmetic in
+ * one place means the recursive and the wavefront engine produce identical
+ * images.
+ */
+#include "random.hpp"
+#include "scene.hpp"
+#include "sphere.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+const int MAX_DEPTH{3};
+
+namespace mini_ray {
+
+// Deepest TraceOptions::max_depth the engines go to. Every bounce is a stack
+// frame of the recursive engine and a set of queues of the wavefront one.
+constexpr int MAX_TRACE_DEPTH{64};
+
+template <typename T> const Vec3<T> BACKGROUND_COLOUR{2};
+// Offset applied to secondary ray origins
+template <typename T> const T BIAS{static_cast<T>(1e-4)};
+
+// Settings of the shading steps, shared by every engine
+struct TraceOptions {
+    // Shadow rays per diffuse hit. 0 evaluates every light; otherwise, when
+    // a scene has more lights than this, that many are importance sampled.
+    int light_samples{0};
+    // Deepest bounce at which a shiny surface still spawns rays, at most
+    // MAX_TRACE_DEPTH
+    int max_depth{MAX_DEPTH};
+    // Scattered rays whose throughput, the largest share of the pixel colour
+    // they can still carry, is below this are not traced. This darkens the
+    // image slightly; 0 traces everything.
+    double min_throughput{0};
+    // From this depth on scattered rays are subject to Russian roulette: a
+    // ray survives with probability min(1, throughput) and its colour is
+    // scaled by the inverse, which leaves the expected image unchanged.
+    // 0 disables it.
+    int roulette_depth{0};
+};
+
+// SplitMix64 finaliser, used to derive sampling decisions from a key
+inline std::uint64_t hash(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+    return x ^ (x >> 31);
+}
+
+template <typename T> T mix(const T &a, const float &b, const float &mix) {
+    return b * mix + a * (1 - mix);
+}
+
+// Geometry at a ray -> sphere intersection
+template <typename T> struct SurfaceHit {
+    Sphere<T> sphere{Point3<T>{}, 0, Vec3<T>{}};
+    Point3<T> p_hit{}; // Point of intersection
+    Vec3<T> n_hit{};   // Normal at intersection, facing the incoming ray
+    bool inside{false};
+};
+
+template <typename T>
+SurfaceHit<T> surface_hit(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                          const Scene<T> &scene, const Hit<T> &hit) {
+    SurfaceHit<T> surface{scene.spheres()[hit.index]};
+
+    surface.p_hit = ray_orig + ray_dir * hit.t;
+    surface.n_hit = surface.p_hit - surface.sphere.centre;
+    surface.n_hit.normalise();
+
+    // If normal vector is in same direction as ray, we have intersected with
+    // the inside of a sphere. Reverse the direction of the normal and set
+    // inside flag to true.
+    if (ray_dir.dot(surface.n_hit) > 0) {
+        surface.n_hit = -surface.n_hit;
+        surface.inside = true;
+    }
+
+    return surface;
+}
+
+// How a hit is shaded: diffuse surfaces with direct light only, reflective
+// ones by a reflection ray, refractive ones by a reflection and a refraction
+// ray (up to the depth limit, past which every surface is shaded diffuse)
+enum class Material { diffuse, reflective, refractive };
+
+template <typename T> Material material(const Sphere<T> &sphere) {
+    if (sphere.transparency > 0)
+        return Material::refractive;
+
+    return sphere.reflection > 0 ? Material::reflective : Material::diffuse;
+}
+
+// Transparent and reflective surfaces spawn further rays until the depth
+// limit; everything else is shaded with direct light only
+template <typename T>
+bool scatters(const Sphere<T> &sphere, int depth,
+              const TraceOptions &options) {
+    return (sphere.transparency > 0 || sphere.reflection > 0) &&
+           depth < options.max_depth;
+}
+
+template <typename T> struct ScatterRays {
+    T fresnel_effect{};
+    bool reflects{true};
+    Vec3<T> refl_orig{}, refl_dir{};
+    bool refracts{false};
+    Vec3<T> refr_orig{}, refr_dir{};
+    // Set by continue_paths()
+    T refl_throughput{1}, refr_throughput{1};
+    T refl_scale{1}, refr_scale{1}; // Applied to the traced colours
+};
+
+// The reflection ray of a shiny surface, and with Refracts its refraction
+// ray, which the surface must be transparent for
+template <bool Refracts, typename T>
+ScatterRays<T> scatter_rays(const Vec3<T> &ray_dir,
+                            const SurfaceHit<T> &surface) {
+    const auto &n_hit{surface.n_hit};
+    ScatterRays<T> rays{};
+
+    auto facing_ratio{-ray_dir.dot(n_hit)};
+    rays.fresnel_effect =
+        mix(static_cast<T>(std::pow(1 - facing_ratio, 3)), 1, 0.1);
+
+    rays.refl_orig = surface.p_hit + n_hit * BIAS<T>;
+    rays.refl_dir = ray_dir - n_hit * 2 * ray_dir.dot(n_hit);
+    rays.refl_dir.normalise();
+
+    if constexpr (Refracts) {
+        T ior{static_cast<T>(1.1)};
+        T eta{surface.inside ? ior : 1 / ior};
+        T cosi{-n_hit.dot(ray_dir)};
+        auto k{1 - (eta * eta) * (1 - (cosi * cosi))};
+
+        rays.refracts = true;
+        rays.refr_orig = surface.p_hit - n_hit * BIAS<T>;
+        rays.refr_dir = ray_dir * eta + n_hit * (eta * cosi - std::sqrt(k));
+        rays.refr_dir.normalise();
+    }
+
+    return rays;
+}
+
+template <typename T>
+ScatterRays<T> scatter(const Vec3<T> &ray_dir, const SurfaceHit<T> &surface) {
+    // Calculate refraction ray if sphere is transparent
+    if (surface.sphere.transparency > 0)
+        return scatter_rays<true>(ray_dir, surface);
+
+    return scatter_rays<false>(ray_dir, surface);
+}
+
+// Stable key of a hit position, so that sampling decisions made at a point
+// are the same whichever thread or engine shades it
+template <typename T> std::uint64_t position_key(const Point3<T> &p) {
+    std::uint64_t key{0};
+
+    for (T c : {p.x, p.y, p.z}) {
+        std::uint64_t bits{};
+        std::memcpy(&bits, &c, sizeof(c));
+        key = hash(key ^ bits);
+    }
+
+    return key;
+}
+
+// Decide which of the scattered rays of a surface reached with the given
+// throughput are traced, see TraceOptions. Rays that are not traced are
+// dropped from rays and contribute black.
+template <typename T>
+void continue_paths(const SurfaceHit<T> &surface, ScatterRays<T> &rays,
+                    int depth, T throughput, const TraceOptions &options) {
+    const auto &colour{surface.sphere.surface_colour};
+    const T largest{std::max({colour.x, colour.y, colour.z})};
+
+    rays.refl_throughput = throughput * rays.fresnel_effect * largest;
+    rays.refr_throughput = throughput * (1 - rays.fresnel_effect) *
+                           surface.sphere.transparency * largest;
+
+    if (options.min_throughput > 0) {
+        rays.reflects = rays.refl_throughput >= options.min_throughput;
+        rays.refracts = rays.refracts &&
+                        rays.refr_throughput >= options.min_throughput;
+    }
+
+    if (options.roulette_depth <= 0 || depth + 1 < options.roulette_depth)
+        return;
+
+    Rng rng{0, 0, 1, static_cast<std::uint32_t>(depth),
+            position_key(surface.p_hit)};
+    const auto roulette = [&](bool &traced, T &path_throughput, T &scale) {
+        const T survival{std::min(static_cast<T>(1), path_throughput)};
+        const T u{rng.uniform<T>()};
+
+        if (!traced || survival >= 1)
+            return;
+
+        if (!(u < survival)) {
+            traced = false;
+            return;
+        }
+
+        scale = 1 / survival;
+        path_throughput *= scale;
+    };
+
+    roulette(rays.reflects, rays.refl_throughput, rays.refl_scale);
+    roulette(rays.refracts, rays.refr_throughput, rays.refr_scale);
+}
+
+// Adjust colour based on object transparency and reflectivity properties.
+// refraction is black for opaque spheres and rays that were not traced.
+template <typename T>
+Vec3<T> scattered_colour(const SurfaceHit<T> &surface,
+                         const ScatterRays<T> &rays, const Vec3<T> &reflection,
+                         const Vec3<T> &refraction) {
+    return (reflection * rays.refl_scale * rays.fresnel_effect +
+            refraction * rays.refr_scale * (1 - rays.fresnel_effect) *
+                surface.sphere.transparency) *
+           surface.sphere.surface_colour;
+}
+
+// Calls visit(light, weight) for each light to evaluate at a diffuse hit.
+// Either every light is visited in input order with weight 1, or
+// options.light_samples lights are drawn in proportion to their power and
+// weighted by 1 / (samples * pdf), which keeps the estimate unbiased.
+template <typename T, typename Visit>
+void select_lights(const SurfaceHit<T> &surface, const Scene<T> &scene,
+                   const TraceOptions &options, Visit &&visit) {
+    const auto &lights{scene.lights()};
+    const auto samples{static_cast<std::size_t>(options.light_samples)};
+
+    if (samples == 0 || lights.size() <= samples) {
+        for (auto i : lights.indices())
+            visit(i, static_cast<T>(1));
+
+        return;
+    }
+
+    Rng rng{0, 0, 0, 0, position_key(surface.p_hit)};
+
+    for (std::size_t k = 0; k < samples; ++k) {
+        const auto light{lights.sample(rng.uniform())};
+
+        visit(light.index, static_cast<T>(1 / (static_cast<double>(samples) *
+                                               light.pdf)));
+    }
+}
+
+template <typename T> Vec3<T> shadow_origin(const SurfaceHit<T> &surface) {
+    return surface.p_hit + surface.n_hit * BIAS<T>;
+}
+
+template <typename T>
+Vec3<T> light_direction(const SurfaceHit<T> &surface,
+                        const Point3<T> &light_centre) {
+    auto direction{light_centre - surface.p_hit};
+    direction.normalise();
+
+    return direction;
+}
+
+// Light arriving from one emitter, given whether its shadow ray is blocked
+// and the weight select_lights() gave it
+template <typename T>
+Vec3<T> light_contribution(const SurfaceHit<T> &surface,
+                           const Vec3<T> &light_direction,
+                           const Vec3<T> &emission_colour, bool occluded,
+                           T weight) {
+    const Vec3<T> transmission{occluded ? static_cast<T>(0)
+                                        : static_cast<T>(1)};
+
+    return surface.sphere.surface_colour * transmission *
+           std::max(static_cast<T>(0), surface.n_hit.dot(light_direction)) *
+           emission_colour * weight;
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef MINIRAY_SIMD_HPP
+#define MINIRAY_SIMD_HPP
+
+/*
+ * Thin wrappers over the AVX2 intrinsics, specialised per scalar type, so a
+ * kernel can be written once and compiled for either precision. A register
+ * holds four doubles or eight floats; SIMD_LANES<T> gives the count.
+ *
+ * Multiplies and adds are kept separate (no FMA) so that vector results
+ * match the scalar code bit for bit.
+ */
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MINIRAY_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+namespace mini_ray {
+
+// Values of T that fit in one 256 bit register
+template <typename T> constexpr std::size_t SIMD_LANES{32 / sizeof(T)};
+
+#ifdef MINIRAY_AVX2_KERNEL
+// Checked once; the AVX2 kernels are compiled with a target attribute so the
+// rest of the program does not need -mavx2
+inline bool avx2_supported() {
+    static const bool supported{__builtin_cpu_supports("avx2") != 0};
+
+    return supported;
+}
+
+template <typename T> struct Avx2;
+
+template <> struct Avx2<double> {
+    using Reg = __m256d;
+
+    __attribute__((target("avx2"))) static Reg zero() {
+        return _mm256_setzero_pd();
+    }
+    __attribute__((target("avx2"))) static Reg set1(double v) {
+        return _mm256_set1_pd(v);
+    }
+    __attribute__((target("avx2"))) static Reg load(const double *p) {
+        return _mm256_load_pd(p);
+    }
+    __attribute__((target("avx2"))) static Reg loadu(const double *p) {
+        return _mm256_loadu_pd(p);
+    }
+    // base[indices[i]] for each lane
+    __attribute__((target("avx2"))) static Reg
+    gather(const double *base, const std::uint32_t *indices) {
+        // The masked form, as the unmasked one reads an undefined source
+        // register in some compilers' headers
+        return _mm256_mask_i32gather_pd(
+            _mm256_setzero_pd(), base,
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices)),
+            _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+    }
+    __attribute__((target("avx2"))) static void store(double *p, Reg a) {
+        _mm256_store_pd(p, a);
+    }
+    __attribute__((target("avx2"))) static void storeu(double *p, Reg a) {
+        _mm256_storeu_pd(p, a);
+    }
+
+    __attribute__((target("avx2"))) static Reg add(Reg a, Reg b) {
+        return _mm256_add_pd(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg sub(Reg a, Reg b) {
+        return _mm256_sub_pd(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg mul(Reg a, Reg b) {
+        return _mm256_mul_pd(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg div(Reg a, Reg b) {
+        return _mm256_div_pd(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg min(Reg a, Reg b) {
+        return _mm256_min_pd(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg max(Reg a, Reg b) {
+        return _mm256_max_pd(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg sqrt(Reg a) {
+        return _mm256_sqrt_pd(a);
+    }
+
+    // Ordered compares: false whenever either side is NaN
+    __attribute__((target("avx2"))) static Reg lt(Reg a, Reg b) {
+        return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+    }
+    __attribute__((target("avx2"))) static Reg gt(Reg a, Reg b) {
+        return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+    }
+    __attribute__((target("avx2"))) static Reg le(Reg a, Reg b) {
+        return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+    }
+    __attribute__((target("avx2"))) static Reg either(Reg a, Reg b) {
+        return _mm256_or_pd(a, b);
+    }
+
+    // b where mask is set, a elsewhere
+    __attribute__((target("avx2"))) static Reg select(Reg a, Reg b,
+                                                      Reg mask) {
+        return _mm256_blendv_pd(a, b, mask);
+    }
+    __attribute__((target("avx2"))) static unsigned int bits(Reg mask) {
+        return static_cast<unsigned int>(_mm256_movemask_pd(mask));
+    }
+};
+
+template <> struct Avx2<float> {
+    using Reg = __m256;
+
+    __attribute__((target("avx2"))) static Reg zero() {
+        return _mm256_setzero_ps();
+    }
+    __attribute__((target("avx2"))) static Reg set1(float v) {
+        return _mm256_set1_ps(v);
+    }
+    __attribute__((target("avx2"))) static Reg load(const float *p) {
+        return _mm256_load_ps(p);
+    }
+    __attribute__((target("avx2"))) static Reg loadu(const float *p) {
+        return _mm256_loadu_ps(p);
+    }
+    __attribute__((target("avx2"))) static Reg
+    gather(const float *base, const std::uint32_t *indices) {
+        return _mm256_mask_i32gather_ps(
+            _mm256_setzero_ps(), base,
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indices)),
+            _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+    }
+    __attribute__((target("avx2"))) static void store(float *p, Reg a) {
+        _mm256_store_ps(p, a);
+    }
+    __attribute__((target("avx2"))) static void storeu(float *p, Reg a) {
+        _mm256_storeu_ps(p, a);
+    }
+
+    __attribute__((target("avx2"))) static Reg add(Reg a, Reg b) {
+        return _mm256_add_ps(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg sub(Reg a, Reg b) {
+        return _mm256_sub_ps(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg mul(Reg a, Reg b) {
+        return _mm256_mul_ps(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg div(Reg a, Reg b) {
+        return _mm256_div_ps(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg min(Reg a, Reg b) {
+        return _mm256_min_ps(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg max(Reg a, Reg b) {
+        return _mm256_max_ps(a, b);
+    }
+    __attribute__((target("avx2"))) static Reg sqrt(Reg a) {
+        return _mm256_sqrt_ps(a);
+    }
+
+    __attribute__((target("avx2"))) static Reg lt(Reg a, Reg b) {
+        return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+    }
+    __attribute__((target("avx2"))) static Reg gt(Reg a, Reg b) {
+        return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+    }
+    __attribute__((target("avx2"))) static Reg le(Reg a, Reg b) {
+        return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+    }
+    __attribute__((target("avx2"))) static Reg either(Reg a, Reg b) {
+        return _mm256_or_ps(a, b);
+    }
+
+    __attribute__((target("avx2"))) static Reg select(Reg a, Reg b,
+                                                      Reg mask) {
+        return _mm256_blendv_ps(a, b, mask);
+    }
+    __attribute__((target("avx2"))) static unsigned int bits(Reg mask) {
+        return static_cast<unsigned int>(_mm256_movemask_ps(mask));
+    }
+};
+#endif
+
+} // namespace mini_ray
+
+#endif
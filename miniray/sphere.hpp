@@ -0,0 +1,65 @@
+#ifndef MINIRAY_SPHERE_HPP
+#define MINIRAY_SPHERE_HPP
+
+#include "stats.hpp"
+#include "vec3.hpp"
+
+#include <cmath>
+
+namespace mini_ray {
+
+// T is the scalar type the whole pipeline computes in, float or double
+template <typename T> class Sphere {
+  public:
+    Point3<T> centre{};
+    T radius{};
+    Vec3<T> surface_colour{};
+    T reflection{}, transparency{};
+    Vec3<T> emission_colour{};
+    T radius_squared{};
+
+    Sphere(const Point3<T> &centre, const T &radius,
+           const Vec3<T> &surface_colour, const T &reflection = 0,
+           const T &transparency = 0,
+           const Vec3<T> &emission_colour = Vec3<T>{})
+        : centre{centre}, radius{radius}, surface_colour{surface_colour},
+          reflection{reflection}, transparency{transparency},
+          emission_colour{emission_colour}, radius_squared{radius * radius} {}
+
+    // Conversion between precisions
+    template <typename U>
+    explicit Sphere(const Sphere<U> &other)
+        : Sphere{Point3<T>{other.centre},
+                 static_cast<T>(other.radius),
+                 Vec3<T>{other.surface_colour},
+                 static_cast<T>(other.reflection),
+                 static_cast<T>(other.transparency),
+                 Vec3<T>{other.emission_colour}} {}
+
+    bool intersect(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir, T &t0,
+                   T &t1) const {
+        Vec3<T> l{centre - ray_orig}; // Distance to sphere centre
+        auto tca{l.dot(ray_dir)};
+
+        MINIRAY_COUNT(sphere_tests, 1);
+
+        if (tca < 0)
+            return false;
+
+        auto d_squared{l.length_squared() - tca * tca};
+
+        if (d_squared > radius_squared)
+            return false;
+
+        auto thc{std::sqrt(radius_squared - d_squared)};
+        t0 = tca - thc;
+        t1 = tca + thc;
+        MINIRAY_COUNT(sphere_hits, 1);
+
+        return true;
+    }
+};
+
+} // namespace mini_ray
+
+#endif
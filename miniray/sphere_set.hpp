@@ -0,0 +1,343 @@
+#ifndef MINIRAY_SPHERE_SET_HPP
+#define MINIRAY_SPHERE_SET_HPP
+
+/*
+ * Structure-of-arrays storage for spheres. The fields read by every
+ * intersection test (centre and squared radius) live in separate aligned
+ * arrays so a test only pulls four scalars per sphere through the cache, and
+ * a full AVX2 register of spheres (four doubles or eight floats) can be tested
+ * at once. The shading fields, which are only needed once a hit has been
+ * found, are kept together per sphere.
+ *
+ * Indexing the set yields an ordinary Sphere, so code written against the
+ * Sphere API keeps working unchanged. A set can also borrow both blocks from
+ * memory owned elsewhere, in which case it is read only.
+ */
+#include "simd.hpp"
+#include "sphere.hpp"
+#include "storage.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace mini_ray {
+
+// Everything about a sphere that is not needed to intersect it
+template <typename T> struct SphereMaterial {
+    T radius{};
+    Vec3<T> surface_colour{};
+    T reflection{}, transparency{};
+    Vec3<T> emission_colour{};
+};
+
+template <typename T> class SphereSet {
+  public:
+    static constexpr std::size_t LANES{SIMD_LANES<T>};
+    static constexpr std::size_t ALIGNMENT{64};
+
+    SphereSet() = default;
+
+    explicit SphereSet(const std::vector<Sphere<T>> &spheres) {
+        reserve(spheres.size());
+
+        for (const auto &sphere : spheres)
+            push_back(sphere);
+    }
+
+    // View size spheres stored elsewhere: hot holds the four hot arrays of
+    // capacity() + LANES elements each (see hot()), materials the rest
+    static SphereSet borrow(const T *hot, std::size_t size,
+                            std::size_t capacity,
+                            const SphereMaterial<T> *materials) {
+        SphereSet set{};
+        set.m_size = size;
+        set.m_capacity = capacity;
+        set.point_at(hot);
+        set.m_materials = Storage<SphereMaterial<T>>::borrow(materials, size);
+
+        return set;
+    }
+
+    // Copies own their data, even when the source is borrowed
+    SphereSet(const SphereSet &other) { *this = other; }
+    SphereSet(SphereSet &&) = default;
+    SphereSet &operator=(SphereSet &&) = default;
+
+    SphereSet &operator=(const SphereSet &other) {
+        if (this == &other)
+            return *this;
+
+        *this = SphereSet{};
+        reserve(other.m_size);
+
+        for (std::size_t i = 0; i < other.m_size; ++i)
+            push_back(other[i]);
+
+        return *this;
+    }
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    void reserve(std::size_t count) {
+        if (count <= m_capacity)
+            return;
+
+        // Round up and keep a spare block of lanes so the kernel can always
+        // load a full vector starting at any valid index
+        const std::size_t capacity{(count + LANES - 1) / LANES * LANES};
+        const std::size_t stride{capacity + LANES};
+
+        HotBuffer buffer{static_cast<T *>(::operator new[](
+            4 * stride * sizeof(T), std::align_val_t{ALIGNMENT}))};
+
+        for (std::size_t i = 0; i < 4 * stride; ++i)
+            buffer[i] = 0;
+
+        // Padding lanes can never be hit
+        for (std::size_t i = 3 * stride; i < 4 * stride; ++i)
+            buffer[i] = -std::numeric_limits<T>::infinity();
+
+        for (std::size_t i = 0; i < m_size; ++i) {
+            buffer[i] = m_centre_x[i];
+            buffer[stride + i] = m_centre_y[i];
+            buffer[2 * stride + i] = m_centre_z[i];
+            buffer[3 * stride + i] = m_radius_squared[i];
+        }
+
+        m_hot = std::move(buffer);
+        m_capacity = capacity;
+        point_at(m_hot.get());
+
+        m_materials.owned().reserve(capacity);
+    }
+
+    void push_back(const Sphere<T> &sphere) {
+        if (m_size == m_capacity)
+            reserve(std::max<std::size_t>(LANES, 2 * m_capacity));
+
+        T *hot{m_hot.get()};
+        const std::size_t stride{m_capacity + LANES};
+
+        hot[m_size] = sphere.centre.x;
+        hot[stride + m_size] = sphere.centre.y;
+        hot[2 * stride + m_size] = sphere.centre.z;
+        hot[3 * stride + m_size] = sphere.radius_squared;
+
+        m_materials.owned().push_back(SphereMaterial<T>{
+            sphere.radius, sphere.surface_colour, sphere.reflection,
+            sphere.transparency, sphere.emission_colour});
+
+        ++m_size;
+    }
+
+    // Replace the sphere at index. Must not be called on a borrowed set.
+    void set(std::size_t index, const Sphere<T> &sphere) {
+        T *hot{m_hot.get()};
+        const std::size_t stride{m_capacity + LANES};
+
+        hot[index] = sphere.centre.x;
+        hot[stride + index] = sphere.centre.y;
+        hot[2 * stride + index] = sphere.centre.z;
+        hot[3 * stride + index] = sphere.radius_squared;
+
+        m_materials.owned()[index] = SphereMaterial<T>{
+            sphere.radius, sphere.surface_colour, sphere.reflection,
+            sphere.transparency, sphere.emission_colour};
+    }
+
+    // A Sphere view of the element at index
+    Sphere<T> operator[](std::size_t index) const {
+        const auto &m{m_materials[index]};
+
+        return Sphere<T>{centre(index),  m.radius,       m.surface_colour,
+                         m.reflection,   m.transparency, m.emission_colour};
+    }
+
+    Point3<T> centre(std::size_t index) const {
+        return Point3<T>{m_centre_x[index], m_centre_y[index],
+                         m_centre_z[index]};
+    }
+    const SphereMaterial<T> &material(std::size_t index) const {
+        return m_materials[index];
+    }
+
+    const T *centre_x() const { return m_centre_x; }
+    const T *centre_y() const { return m_centre_y; }
+    const T *centre_z() const { return m_centre_z; }
+    const T *radius_squared() const { return m_radius_squared; }
+
+    // The hot arrays as one block: centre_x, centre_y, centre_z and
+    // radius_squared, each capacity() + LANES elements long
+    const T *hot() const { return m_centre_x; }
+    std::size_t capacity() const { return m_capacity; }
+    const Storage<SphereMaterial<T>> &materials() const { return m_materials; }
+
+    // Intersect the ray with spheres [first, first + LANES). Bit i of the
+    // result is set if sphere first + i is hit, in which case t[i] holds the
+    // nearest non-negative hit distance (the far side when the ray starts
+    // inside). Matches Sphere::intersect exactly, including for NaN rays.
+    // Lanes past size() read padding and must be masked off by the caller,
+    // see lane_mask().
+    unsigned int intersect(std::size_t first, const Vec3<T> &ray_orig,
+                           const Vec3<T> &ray_dir, T *t) const {
+#ifdef MINIRAY_AVX2_KERNEL
+        if (avx2_supported())
+            return intersect_avx2(first, ray_orig, ray_dir, t);
+#endif
+        return intersect_scalar(
+            [first](std::size_t lane) { return first + lane; }, ray_orig,
+            ray_dir, t);
+    }
+
+    // As above for the spheres at indices[0, LANES), which need not be
+    // consecutive. Every one of the LANES indices must be below size().
+    unsigned int intersect(const std::uint32_t *indices,
+                           const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                           T *t) const {
+#ifdef MINIRAY_AVX2_KERNEL
+        if (avx2_supported())
+            return intersect_avx2(indices, ray_orig, ray_dir, t);
+#endif
+        return intersect_scalar([indices](std::size_t lane) {
+            return static_cast<std::size_t>(indices[lane]);
+        }, ray_orig, ray_dir, t);
+    }
+
+    // Mask selecting the lanes of a block that lie before last
+    static unsigned int lane_mask(std::size_t first, std::size_t last) {
+        return last - first >= LANES ? (1u << LANES) - 1
+                                     : (1u << (last - first)) - 1;
+    }
+
+  private:
+    struct AlignedDelete {
+        void operator()(T *p) const {
+            ::operator delete[](p, std::align_val_t{ALIGNMENT});
+        }
+    };
+    using HotBuffer = std::unique_ptr<T[], AlignedDelete>;
+
+    HotBuffer m_hot{}; // Empty when borrowed
+    const T *m_centre_x{nullptr};
+    const T *m_centre_y{nullptr};
+    const T *m_centre_z{nullptr};
+    const T *m_radius_squared{nullptr};
+    std::size_t m_size{0}, m_capacity{0};
+
+    Storage<SphereMaterial<T>> m_materials{};
+
+    void point_at(const T *hot) {
+        const std::size_t stride{m_capacity + LANES};
+
+        m_centre_x = hot;
+        m_centre_y = m_centre_x + stride;
+        m_centre_z = m_centre_y + stride;
+        m_radius_squared = m_centre_z + stride;
+    }
+
+    // Same arithmetic, in the same order, as Sphere::intersect, for the
+    // spheres index(0) to index(LANES - 1)
+    template <typename Index>
+    unsigned int intersect_scalar(Index &&index, const Vec3<T> &ray_orig,
+                                  const Vec3<T> &ray_dir, T *t) const {
+        unsigned int mask{0};
+
+        for (std::size_t lane = 0; lane < LANES; ++lane) {
+            const std::size_t i{index(lane)};
+            const T lx{m_centre_x[i] - ray_orig.x};
+            const T ly{m_centre_y[i] - ray_orig.y};
+            const T lz{m_centre_z[i] - ray_orig.z};
+            const T tca{lx * ray_dir.x + ly * ray_dir.y + lz * ray_dir.z};
+
+            if (tca < 0)
+                continue;
+
+            const T d_squared{(lx * lx + ly * ly + lz * lz) - tca * tca};
+
+            if (d_squared > m_radius_squared[i])
+                continue;
+
+            const T thc{std::sqrt(m_radius_squared[i] - d_squared)};
+            const T t0{tca - thc};
+
+            t[lane] = t0 < 0 ? tca + thc : t0;
+            mask |= 1u << lane;
+        }
+
+        return mask;
+    }
+
+#ifdef MINIRAY_AVX2_KERNEL
+    __attribute__((target("avx2"))) unsigned int
+    intersect_avx2(std::size_t first, const Vec3<T> &ray_orig,
+                   const Vec3<T> &ray_dir, T *t) const {
+        using V = Avx2<T>;
+
+        return intersect_avx2(
+            V::loadu(m_centre_x + first), V::loadu(m_centre_y + first),
+            V::loadu(m_centre_z + first), V::loadu(m_radius_squared + first),
+            ray_orig, ray_dir, t);
+    }
+
+    __attribute__((target("avx2"))) unsigned int
+    intersect_avx2(const std::uint32_t *indices, const Vec3<T> &ray_orig,
+                   const Vec3<T> &ray_dir, T *t) const {
+        using V = Avx2<T>;
+
+        return intersect_avx2(
+            V::gather(m_centre_x, indices), V::gather(m_centre_y, indices),
+            V::gather(m_centre_z, indices),
+            V::gather(m_radius_squared, indices), ray_orig, ray_dir, t);
+    }
+
+    // The test itself, on spheres already loaded into registers
+    __attribute__((target("avx2"))) static unsigned int
+    intersect_avx2(typename Avx2<T>::Reg centre_x,
+                   typename Avx2<T>::Reg centre_y,
+                   typename Avx2<T>::Reg centre_z, typename Avx2<T>::Reg r2,
+                   const Vec3<T> &ray_orig, const Vec3<T> &ray_dir, T *t) {
+        using V = Avx2<T>;
+        using Reg = typename V::Reg;
+
+        const Reg lx{V::sub(centre_x, V::set1(ray_orig.x))};
+        const Reg ly{V::sub(centre_y, V::set1(ray_orig.y))};
+        const Reg lz{V::sub(centre_z, V::set1(ray_orig.z))};
+
+        const Reg tca{V::add(V::add(V::mul(lx, V::set1(ray_dir.x)),
+                                    V::mul(ly, V::set1(ray_dir.y))),
+                             V::mul(lz, V::set1(ray_dir.z)))};
+        const Reg length_squared{
+            V::add(V::add(V::mul(lx, lx), V::mul(ly, ly)), V::mul(lz, lz))};
+        const Reg d_squared{V::sub(length_squared, V::mul(tca, tca))};
+
+        // Rejections use ordered compares like the scalar early outs, so a
+        // NaN lane counts as a hit there too
+        const Reg miss{
+            V::either(V::lt(tca, V::zero()), V::gt(d_squared, r2))};
+        const auto mask{V::bits(miss) ^ ((1u << LANES) - 1)};
+
+        if (mask == 0)
+            return 0;
+
+        const Reg thc{V::sqrt(V::sub(r2, d_squared))};
+        const Reg t0{V::sub(tca, thc)};
+        const Reg t1{V::add(tca, thc)};
+
+        V::storeu(t, V::select(t0, t1, V::lt(t0, V::zero())));
+
+        return mask;
+    }
+#endif
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef MINIRAY_STATS_HPP
+#define MINIRAY_STATS_HPP
+
+/*
+ * Ray statistics, compiled in only when MINIRAY_STATS is defined. Each
+ * thread counts into its own RayStats through MINIRAY_COUNT, so counting
+ * never touches shared memory; the tile renderer merges the counters of a
+ * tile into RenderOptions::stats once it is traced, and can also record the
+ * cost of every pixel for a heatmap.
+ *
+ * Without MINIRAY_STATS, MINIRAY_COUNT expands to nothing, its arguments are
+ * never evaluated and no thread local storage is used.
+ */
+#include "image.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mini_ray {
+
+#ifdef MINIRAY_STATS
+inline constexpr bool STATS_ENABLED{true};
+#else
+inline constexpr bool STATS_ENABLED{false};
+#endif
+
+struct RayStats {
+    // Rays deeper than the last bin are counted in it
+    static constexpr int DEPTH_BINS{16};
+
+    std::uint64_t primary{0}, reflection{0}, refraction{0}, shadow{0};
+    std::uint64_t box_tests{0};    // Ray against BVH node or grid cell
+    std::uint64_t sphere_tests{0}; // Ray against sphere
+    std::uint64_t sphere_hits{0};
+    std::array<std::uint64_t, DEPTH_BINS> depth{}; // Camera and bounce rays
+
+    // Work spent, in ray-primitive tests
+    std::uint64_t cost() const { return box_tests + sphere_tests; }
+
+    void merge(const RayStats &other) {
+        primary += other.primary;
+        reflection += other.reflection;
+        refraction += other.refraction;
+        shadow += other.shadow;
+        box_tests += other.box_tests;
+        sphere_tests += other.sphere_tests;
+        sphere_hits += other.sphere_hits;
+
+        for (int i = 0; i < DEPTH_BINS; ++i)
+            depth[i] += other.depth[i];
+    }
+
+    static int depth_bin(int depth) {
+        return std::clamp(depth, 0, DEPTH_BINS - 1);
+    }
+};
+
+// The counters of the calling thread
+inline RayStats &thread_stats() {
+    thread_local RayStats stats{};
+
+    return stats;
+}
+
+// RayStats::cost() of the calling thread so far, 0 without MINIRAY_STATS
+inline std::uint64_t thread_cost() {
+    if constexpr (STATS_ENABLED)
+        return thread_stats().cost();
+    else
+        return 0;
+}
+
+#ifdef MINIRAY_STATS
+#define MINIRAY_COUNT(counter, n)                                              \
+    (::mini_ray::thread_stats().counter += static_cast<std::uint64_t>(n))
+#else
+#define MINIRAY_COUNT(counter, n) ((void)0)
+#endif
+
+// Totals of a render, filled in when built with MINIRAY_STATS
+struct RenderStats {
+    RayStats rays{};
+    // RayStats::cost() per pixel, over every sample it took, row major.
+    // Only recorded when sized to the image before rendering.
+    std::vector<std::uint64_t> cost{};
+};
+
+// Map pixel costs to colours on a log scale, from black for the cheapest
+// pixel through blue, red and yellow to white for the most expensive
+inline Image<double> cost_heatmap(const std::vector<std::uint64_t> &cost,
+                                  int width, int height) {
+    Image<double> image{width, height};
+
+    if (cost.empty())
+        return image;
+
+    const auto [low, high]{std::minmax_element(cost.begin(), cost.end())};
+    const double base{std::log1p(static_cast<double>(*low))};
+    const double range{std::log1p(static_cast<double>(*high)) - base};
+    const Vec3<double> ramp[]{{0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 1, 0},
+                              {1, 1, 1}};
+    constexpr int segments{static_cast<int>(std::size(ramp)) - 1};
+
+    for (std::size_t i = 0; i < image.pixels.size(); ++i) {
+        const double v{
+            range > 0
+                ? (std::log1p(static_cast<double>(cost[i])) - base) / range
+                : 0};
+        const int segment{std::min(static_cast<int>(v * segments),
+                                   segments - 1)};
+        const double f{v * segments - segment};
+
+        image.pixels[i] = ramp[segment] * (1 - f) + ramp[segment + 1] * f;
+    }
+
+    return image;
+}
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef MINIRAY_STORAGE_HPP
+#define MINIRAY_STORAGE_HPP
+
+/*
+ * An array that either owns its elements or borrows them from memory owned
+ * elsewhere, such as a mapped scene file. Scene data is built into owned
+ * storage and only read afterwards, so the containers of a scene can point
+ * straight at a file instead of copying it.
+ */
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+template <typename T> class Storage {
+  public:
+    Storage() = default;
+    explicit Storage(std::vector<T> owned) : m_owned{std::move(owned)} {}
+
+    // View count elements at data. The memory must outlive this object and
+    // every copy of it, which borrow the same memory.
+    static Storage borrow(const T *data, std::size_t count) {
+        Storage storage{};
+        storage.m_borrowed = data;
+        storage.m_size = count;
+
+        return storage;
+    }
+
+    bool borrowed() const { return m_borrowed != nullptr; }
+
+    // The elements for building. Must not be called on borrowed storage.
+    std::vector<T> &owned() { return m_owned; }
+
+    const T *data() const { return m_borrowed ? m_borrowed : m_owned.data(); }
+    std::size_t size() const { return m_borrowed ? m_size : m_owned.size(); }
+    bool empty() const { return size() == 0; }
+
+    const T &operator[](std::size_t index) const { return data()[index]; }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+
+  private:
+    std::vector<T> m_owned{};
+    const T *m_borrowed{nullptr};
+    std::size_t m_size{0};
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef MINIRAY_STREAMING_HPP
+#define MINIRAY_STREAMING_HPP
+
+/*
+ * Out-of-core rendering for frames too large to hold in memory, such as
+ * 64k x 64k posters. The frame is rendered a band of rows at a time: the
+ * tiles of a band are traced in parallel into a band sized framebuffer,
+ * which a writer thread then converts and appends to the file while the next
+ * band is traced into a second buffer. Memory for pixels is therefore bounded
+ * by the budget, whatever the size of the frame.
+ *
+ * The budget covers both band buffers and the bytes of the band being
+ * written; bands are made as tall as it allows, rounded down to whole rows of
+ * tiles where possible. Bands thinner than a tile are stored in scanline
+ * layout. The budget does not cover the scene.
+ */
+#include "framebuffer.hpp"
+#include "image.hpp"
+#include "scene.hpp"
+#include "tile_renderer.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mini_ray {
+
+struct StreamOptions {
+    std::size_t memory_budget{std::size_t{256} << 20}; // Bytes
+    std::string path{"./miniray/image.ppm"};
+};
+
+struct StreamStats {
+    int bands{0};
+    int band_height{0};         // Rows per band, the last may have fewer
+    std::size_t buffer_bytes{0}; // Memory held for pixels while rendering
+};
+
+template <typename T> class StreamRenderer {
+  public:
+    StreamRenderer(const Scene<T> &scene, const RenderOptions &options,
+                   const StreamOptions &stream = {})
+        : m_renderer{scene, checked(options)}, m_stream{stream},
+          m_format{stored_format<T>(options.pixel_format)} {
+        m_stats.band_height = band_height();
+        m_stats.buffer_bytes = band_bytes(m_stats.band_height);
+    }
+
+    const StreamStats &stats() const { return m_stats; }
+
+    // Render the frame to the file of the stream options
+    void run() {
+        const auto &options{m_renderer.options()};
+        const int rows{m_stats.band_height};
+        std::ofstream file{m_stream.path, std::ios::binary};
+
+        if (!file)
+            throw std::runtime_error{"cannot create " + m_stream.path};
+
+        write_ppm_header(file, options.width, options.height);
+
+        Framebuffer bands[2]{{options.width, rows, m_format, layout(rows),
+                              m_renderer.tile_size()},
+                             {options.width, rows, m_format, layout(rows),
+                              m_renderer.tile_size()}};
+        std::vector<unsigned char> bytes{};
+        std::thread writer{};
+
+        // The writer may still be using a band when tracing throws
+        const auto wait_for_writer = [&] {
+            if (writer.joinable())
+                writer.join();
+        };
+
+        try {
+            for (int y0 = 0, band = 0; y0 < options.height;
+                 y0 += rows, ++band) {
+                const int y1{std::min(y0 + rows, options.height)};
+                auto &frame{bands[band % 2]};
+
+                trace_band(frame, y0, y1);
+
+                // The other buffer is free once its band is written
+                wait_for_writer();
+                writer = std::thread{[&frame, &bytes, &file, y0, y1] {
+                    encode_rows(frame, 0, y1 - y0, bytes);
+                    write_bytes(file, bytes);
+                }};
+                ++m_stats.bands;
+            }
+        } catch (...) {
+            wait_for_writer();
+            throw;
+        }
+
+        wait_for_writer();
+        file.close();
+
+        if (!file)
+            throw std::runtime_error{"cannot write " + m_stream.path};
+    }
+
+  private:
+    TileRenderer<T> m_renderer;
+    StreamOptions m_stream;
+    PixelFormat m_format;
+    StreamStats m_stats{};
+
+    // A cost map covers the whole frame
+    static const RenderOptions &checked(const RenderOptions &options) {
+        if (options.cost_map)
+            throw std::invalid_argument{
+                "a streamed render cannot record a cost map"};
+
+        return options;
+    }
+
+    // Bands thinner than a tile would be padded to whole tiles, so they are
+    // stored row by row
+    PixelLayout layout(int rows) const {
+        return rows < m_renderer.tile_size()
+                   ? PixelLayout::scanline
+                   : m_renderer.options().pixel_layout;
+    }
+
+    // Two band buffers and the bytes of one band
+    std::size_t band_bytes(int rows) const {
+        const auto &options{m_renderer.options()};
+
+        return 2 * Framebuffer::bytes_needed(options.width, rows, m_format,
+                                             layout(rows),
+                                             m_renderer.tile_size()) +
+               static_cast<std::size_t>(rows) * options.width * 3;
+    }
+
+    int band_height() const {
+        const int height{m_renderer.options().height};
+
+        if (band_bytes(1) > m_stream.memory_budget)
+            throw std::invalid_argument{
+                "memory budget too small for one row of the frame"};
+
+        // Tallest band within the budget; the cost grows with the rows
+        int low{1}, high{std::max(1, height)};
+
+        while (low < high) {
+            const int middle{low + (high - low + 1) / 2};
+
+            if (band_bytes(middle) <= m_stream.memory_budget)
+                low = middle;
+            else
+                high = middle - 1;
+        }
+
+        // Whole rows of tiles keep the tiles of the framebuffer aligned
+        const int tile{m_renderer.tile_size()};
+
+        return low >= tile && low < height ? low / tile * tile : low;
+    }
+
+    // Trace rows [y0, y1) into frame, whose row 0 is row y0 of the image
+    void trace_band(Framebuffer &frame, int y0, int y1) {
+        const int width{m_renderer.options().width};
+        const int size{m_renderer.tile_size()};
+        const int tiles_x{(width + size - 1) / size};
+        const int tiles_y{(y1 - y0 + size - 1) / size};
+        const auto &camera{m_renderer.camera()};
+
+        m_renderer.pool().parallel_for(
+            static_cast<std::size_t>(tiles_x) * tiles_y,
+            [&](std::size_t index) {
+                const int x0{static_cast<int>(index % tiles_x) * size};
+                const int ty0{y0 + static_cast<int>(index / tiles_x) * size};
+                const Tile tile{x0, ty0, std::min(x0 + size, width),
+                                std::min(ty0 + size, y1)};
+
+                m_renderer.trace(
+                    tile, [](int, int) { return true; },
+                    [&](int x, int y) { return camera.ray(x, y); },
+                    [&](int x, int y, const Vec3<T> &colour) {
+                        frame.store(x, y - y0, colour);
+                    });
+            });
+    }
+};
+
+} // namespace mini_ray
+
+#endif
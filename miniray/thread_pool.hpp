@@ -0,0 +1,216 @@
+#ifndef MINIRAY_THREAD_POOL_HPP
+#define MINIRAY_THREAD_POOL_HPP
+
+/*
+ * Work-stealing thread pool used to spread independent jobs (image tiles,
+ * bands, build tasks) across cores. Each worker owns a deque: it pops its own
+ * work from the back and steals from the front of the other queues when it
+ * runs dry. The thread calling parallel_for() takes part in the work, so a
+ * pool of N threads spawns N - 1 workers.
+ */
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mini_ray {
+
+class ThreadPool {
+  public:
+    // A thread_count of 0 uses every hardware thread available
+    explicit ThreadPool(unsigned int thread_count = 0) {
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+        // The calling thread is the last member of the pool
+        for (unsigned int i = 0; i < thread_count; ++i)
+            m_queues.push_back(std::make_unique<WorkQueue>());
+
+        for (unsigned int i = 0; i + 1 < thread_count; ++i)
+            m_workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock{m_wake_mutex};
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+
+        for (auto &worker : m_workers)
+            worker.join();
+    }
+
+    unsigned int size() const {
+        return static_cast<unsigned int>(m_queues.size());
+    }
+
+    // Index in [0, size()) of the calling thread while it runs a job of this
+    // pool. Only one thread at a time has a given index, so it can be used to
+    // pick per-thread scratch space. Threads outside the pool get size() - 1,
+    // the slot of the thread that called parallel_for().
+    unsigned int thread_index() const {
+        return t_pool == this ? t_index : size() - 1;
+    }
+
+    // Run task(i) for every i in [0, count) and block until all have
+    // finished. The first exception thrown by a task is rethrown here.
+    void parallel_for(std::size_t count,
+                      const std::function<void(std::size_t)> &task) {
+        if (count == 0)
+            return;
+
+        Batch batch{count};
+
+        // Count the jobs before publishing them so claim() never underflows
+        {
+            std::lock_guard<std::mutex> lock{m_wake_mutex};
+            m_pending += count;
+        }
+
+        // Deal jobs out round-robin; stealing evens out any imbalance. Each
+        // queue is filled from the front, so its owner pops its jobs in
+        // ascending order (tiles finish roughly top to bottom) while thieves
+        // take the far end.
+        for (std::size_t i = 0; i < count; ++i) {
+            auto &queue{*m_queues[i % m_queues.size()]};
+            std::lock_guard<std::mutex> lock{queue.mutex};
+
+            queue.jobs.push_front([&batch, &task, i] {
+                std::exception_ptr error{};
+
+                try {
+                    task(i);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+
+                // The batch lives on the caller's stack, so it must not be
+                // touched once the lock is released after the last job
+                std::lock_guard<std::mutex> lock{batch.mutex};
+
+                if (error && !batch.error)
+                    batch.error = error;
+
+                if (batch.remaining.fetch_sub(1) == 1)
+                    batch.done.notify_all();
+            });
+        }
+
+        m_wake.notify_all();
+
+        // Help out until our own batch has drained
+        const auto self{static_cast<unsigned int>(m_queues.size() - 1)};
+        std::function<void()> job{};
+
+        while (batch.remaining.load() > 0 && try_pop(self, job)) {
+            job();
+            job = nullptr;
+        }
+
+        std::unique_lock<std::mutex> lock{batch.mutex};
+        batch.done.wait(lock, [&batch] { return batch.remaining.load() == 0; });
+
+        if (batch.error)
+            std::rethrow_exception(batch.error);
+    }
+
+  private:
+    struct WorkQueue {
+        std::mutex mutex{};
+        std::deque<std::function<void()>> jobs{};
+    };
+
+    struct Batch {
+        explicit Batch(std::size_t count) : remaining{count} {}
+
+        std::atomic<std::size_t> remaining;
+        std::mutex mutex{};
+        std::condition_variable done{};
+        std::exception_ptr error{};
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues{};
+    std::vector<std::thread> m_workers{};
+
+    std::mutex m_wake_mutex{};
+    std::condition_variable m_wake{};
+    std::size_t m_pending{0};
+    bool m_stopping{false};
+
+    // Take from the back of our own queue, otherwise steal from the front of
+    // someone else's
+    bool try_pop(unsigned int index, std::function<void()> &job) {
+        {
+            auto &own{*m_queues[index]};
+            std::lock_guard<std::mutex> lock{own.mutex};
+
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                claim();
+
+                return true;
+            }
+        }
+
+        for (std::size_t offset = 1; offset < m_queues.size(); ++offset) {
+            auto &victim{*m_queues[(index + offset) % m_queues.size()]};
+            std::lock_guard<std::mutex> lock{victim.mutex};
+
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                claim();
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void claim() {
+        std::lock_guard<std::mutex> lock{m_wake_mutex};
+        --m_pending;
+    }
+
+    static inline thread_local const ThreadPool *t_pool{nullptr};
+    static inline thread_local unsigned int t_index{0};
+
+    void worker_loop(unsigned int index) {
+        t_pool = this;
+        t_index = index;
+
+        std::function<void()> job{};
+
+        while (true) {
+            if (try_pop(index, job)) {
+                job();
+                job = nullptr;
+
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock{m_wake_mutex};
+            m_wake.wait(lock, [this] { return m_stopping || m_pending > 0; });
+
+            if (m_stopping && m_pending == 0)
+                return;
+        }
+    }
+};
+
+} // namespace mini_ray
+
+#endif
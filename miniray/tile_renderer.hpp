@@ -0,0 +1,309 @@
+#ifndef MINIRAY_TILE_RENDERER_HPP
+#define MINIRAY_TILE_RENDERER_HPP
+
+/*
+ * Traces the primary rays of image tiles with whichever engine the render
+ * options select. Callers decide which pixels of a tile need a ray, where
+ * each ray goes and what happens to the colour it brings back, so one-shot,
+ * progressive and adaptive rendering all share the same tracing code.
+ *
+ * Pixels, or packet blocks, are visited in the order the options select,
+ * see pixel_order.hpp. The renderer owns the thread pool, and one wavefront
+ * tracer per pool thread so their queues are reused from tile to tile. Built
+ * with MINIRAY_STATS it also collects the ray statistics of every tile it
+ * traces, see stats.hpp.
+ */
+#include "camera.hpp"
+#include "framebuffer.hpp"
+#include "image.hpp"
+#include "packet.hpp"
+#include "pixel_order.hpp"
+#include "scene.hpp"
+#include "shading.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include "vec3.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+enum class Engine {
+    recursive, // trace() per pixel
+    wavefront, // Queue based, one batch of rays per tile and bounce
+};
+
+struct RenderOptions {
+    int width{600}, height{480};
+    unsigned int threads{0}; // 0 uses every hardware thread
+    int tile_size{32};       // Edge length in pixels of a scheduled tile
+    bool packets{true};      // Trace primary rays in 4x4 packets
+    PixelOrder pixel_order{PixelOrder::scanline}; // Within each tile
+    Engine engine{Engine::recursive};
+    bool sort_queues{true}; // Wavefront only: sort queues by direction
+    int light_samples{0};   // See TraceOptions::light_samples
+    int max_depth{MAX_DEPTH}; // See TraceOptions for these three
+    double min_throughput{0};
+    int roulette_depth{0};
+    // Reset and filled in while rendering when built with MINIRAY_STATS
+    RenderStats *stats{nullptr};
+    bool cost_map{false}; // Also record RenderStats::cost
+    // Storage of frames that are streamed to a file, see framebuffer.hpp
+    PixelFormat pixel_format{PixelFormat::native};
+    PixelLayout pixel_layout{PixelLayout::tiled};
+};
+
+template <typename T> class TileRenderer {
+  public:
+    TileRenderer(const Scene<T> &scene, const RenderOptions &options)
+        : m_scene{scene}, m_options{options},
+          m_camera{options.width, options.height},
+          m_tile_size{std::max(1, options.tile_size)},
+          m_tiles_x{(options.width + m_tile_size - 1) / m_tile_size},
+          m_tiles_y{(options.height + m_tile_size - 1) / m_tile_size},
+          m_pool{options.threads} {
+        m_trace_options.light_samples = options.light_samples;
+        m_trace_options.max_depth =
+            std::clamp(options.max_depth, 0, MAX_TRACE_DEPTH);
+        m_trace_options.min_throughput = options.min_throughput;
+        m_trace_options.roulette_depth = options.roulette_depth;
+
+        if (options.pixel_order != PixelOrder::scanline) {
+            const int width{std::min(m_tile_size, options.width)};
+            const int height{std::min(m_tile_size, options.height)};
+            constexpr int block{RayPacket<T>::WIDTH};
+
+            m_pixel_cells = pixel_order(options.pixel_order, width, height);
+            m_block_cells =
+                pixel_order(options.pixel_order, (width + block - 1) / block,
+                            (height + block - 1) / block);
+        }
+
+        if (collecting()) {
+            *options.stats = RenderStats{};
+
+            if (options.cost_map)
+                options.stats->cost.resize(
+                    static_cast<std::size_t>(options.width) * options.height);
+        }
+
+        if (options.engine == Engine::wavefront) {
+            m_tracers.reserve(m_pool.size());
+
+            for (unsigned int i = 0; i < m_pool.size(); ++i)
+                m_tracers.emplace_back(scene, m_trace_options,
+                                       options.sort_queues);
+        }
+    }
+
+    const RenderOptions &options() const { return m_options; }
+    const Camera<T> &camera() const { return m_camera; }
+    ThreadPool &pool() { return m_pool; }
+    int tile_size() const { return m_tile_size; }
+
+    std::size_t tile_count() const {
+        return static_cast<std::size_t>(m_tiles_x) * m_tiles_y;
+    }
+
+    Tile tile(std::size_t index) const {
+        const int x0{static_cast<int>(index % m_tiles_x) * m_tile_size};
+        const int y0{static_cast<int>(index / m_tiles_x) * m_tile_size};
+
+        return Tile{x0, y0, std::min(x0 + m_tile_size, m_options.width),
+                    std::min(y0 + m_tile_size, m_options.height)};
+    }
+
+    // Trace every pixel of the image once through its centre, calling
+    // done(tile) as each tile is finished
+    template <typename Store, typename Done>
+    void render(Store &&store, Done &&done) {
+        m_pool.parallel_for(tile_count(), [&](std::size_t index) {
+            const auto region{tile(index)};
+
+            trace(
+                region, [](int, int) { return true; },
+                [&](int x, int y) { return m_camera.ray(x, y); }, store);
+            done(region);
+        });
+    }
+
+    template <typename Store> void render(Store &&store) {
+        render(store, [](const Tile &) {});
+    }
+
+    // Trace one primary ray for each pixel (x, y) of the tile for which
+    // want(x, y) holds, in direction ray(x, y), and pass the colour it sees
+    // to store(x, y, colour). Must be called from a job of pool().
+    template <typename Want, typename Ray, typename Store>
+    void trace(const Tile &tile, Want &&want, Ray &&ray, Store &&store) {
+        if (!collecting())
+            return trace_tile(tile, want, ray, store);
+
+        thread_stats() = RayStats{};
+
+        trace_tile(
+            tile,
+            [&](int x, int y) {
+                if (!want(x, y))
+                    return false;
+
+                MINIRAY_COUNT(primary, 1);
+                MINIRAY_COUNT(depth[0], 1);
+                return true;
+            },
+            ray, store);
+
+        std::lock_guard<std::mutex> lock{m_stats_mutex};
+        m_options.stats->rays.merge(thread_stats());
+    }
+
+  private:
+    const Scene<T> &m_scene;
+    RenderOptions m_options;
+    TraceOptions m_trace_options{};
+    Camera<T> m_camera;
+    int m_tile_size, m_tiles_x, m_tiles_y;
+    ThreadPool m_pool;
+    std::vector<WavefrontTracer<T>> m_tracers{};
+    std::mutex m_stats_mutex{};
+    // Offsets of the pixels of a full tile, and of its packet blocks, in
+    // the pixel order; empty for scanline order
+    std::vector<std::pair<int, int>> m_pixel_cells{}, m_block_cells{};
+
+    bool collecting() const { return STATS_ENABLED && m_options.stats; }
+
+    // Add work to the cost of a pixel, if a cost map is being recorded
+    void add_cost(int x, int y, std::uint64_t cost) {
+        if constexpr (STATS_ENABLED) {
+            if (m_options.stats && m_options.cost_map)
+                m_options.stats->cost[static_cast<std::size_t>(y) *
+                                          m_options.width +
+                                      x] += cost;
+        }
+    }
+
+    // Call f(x, y) for the pixels of the tile in the pixel order, or with
+    // step > 1 for the corner of each step x step block of it
+    template <typename F>
+    void for_each_pixel(const Tile &tile, int step, F &&f) const {
+        const auto &cells{step == 1 ? m_pixel_cells : m_block_cells};
+
+        if (cells.empty()) {
+            for (int y = tile.y0; y < tile.y1; y += step) {
+                for (int x = tile.x0; x < tile.x1; x += step)
+                    f(x, y);
+            }
+
+            return;
+        }
+
+        for (const auto &[cx, cy] : cells) {
+            const int x{tile.x0 + cx * step}, y{tile.y0 + cy * step};
+
+            if (x < tile.x1 && y < tile.y1)
+                f(x, y);
+        }
+    }
+
+    template <typename Want, typename Ray, typename Store>
+    void trace_tile(const Tile &tile, Want &&want, Ray &&ray, Store &&store) {
+        if (m_options.engine == Engine::wavefront) {
+            std::vector<Vec3<T>> origs{}, dirs{}, colours{};
+            std::vector<std::pair<int, int>> pixels{};
+            std::vector<std::uint64_t> costs{};
+
+            for_each_pixel(tile, 1, [&](int x, int y) {
+                if (!want(x, y))
+                    return;
+
+                origs.emplace_back();
+                dirs.push_back(ray(x, y));
+                pixels.emplace_back(x, y);
+            });
+
+            colours.resize(dirs.size());
+            costs.assign(collecting() ? dirs.size() : 0, 0);
+            m_tracers[m_pool.thread_index()].trace(
+                origs, dirs, colours.data(),
+                costs.empty() ? nullptr : costs.data());
+
+            for (std::size_t i = 0; i < pixels.size(); ++i) {
+                if (!costs.empty())
+                    add_cost(pixels[i].first, pixels[i].second, costs[i]);
+
+                store(pixels[i].first, pixels[i].second, colours[i]);
+            }
+
+            return;
+        }
+
+        if (!m_options.packets) {
+            for_each_pixel(tile, 1, [&](int x, int y) {
+                if (!want(x, y))
+                    return;
+
+                const auto before{thread_cost()};
+                const auto colour{mini_ray::trace(Vec3<T>{}, ray(x, y),
+                                                  m_scene, 0,
+                                                  m_trace_options)};
+
+                add_cost(x, y, thread_cost() - before);
+                store(x, y, colour);
+            });
+
+            return;
+        }
+
+        // Find the primary hits a block at a time, then shade each pixel
+        constexpr int width{RayPacket<T>::WIDTH};
+
+        for_each_pixel(tile, width, [&](int bx, int by) {
+            RayPacket<T> packet{};
+
+            for (int y = by; y < std::min(by + width, tile.y1); ++y) {
+                for (int x = bx; x < std::min(bx + width, tile.x1); ++x) {
+                    if (want(x, y))
+                        packet.set((y - by) * width + (x - bx), ray(x, y));
+                }
+            }
+
+            if (!packet.active)
+                return;
+
+            // The rays of a packet share its traversal, so each is charged
+            // an equal part of it
+            auto before{thread_cost()};
+            closest_hit(m_scene, packet);
+            const std::uint64_t share{
+                (thread_cost() - before) /
+                static_cast<std::uint64_t>(
+                    RayPacket<T>::lane_count(packet.active))};
+
+            for (int lane = 0; lane < RayPacket<T>::SIZE; ++lane) {
+                if (!(packet.active >> lane & 1u))
+                    continue;
+
+                const int x{bx + lane % width}, y{by + lane / width};
+
+                before = thread_cost();
+                const auto colour{shade(packet.origin, packet.direction(lane),
+                                        m_scene, 0, packet.hits[lane],
+                                        m_trace_options)};
+
+                add_cost(x, y, share + thread_cost() - before);
+                store(x, y, colour);
+            }
+        });
+    }
+};
+
+} // namespace mini_ray
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef MINIRAY_TRACE_HPP
+#define MINIRAY_TRACE_HPP
+
+/*
+ * The recursive engine: trace() follows a ray and calls itself for the
+ * reflection and refraction rays of shiny surfaces, down to
+ * TraceOptions::max_depth. Each call carries the throughput of its path so
+ * that rays carrying little can be cut off, see continue_paths().
+ *
+ * For depth limits up to MAX_UNROLLED_DEPTH the recursion is instantiated
+ * per depth, so the depth tests are resolved at compile time and the last
+ * bounce is compiled without any scattering code. Each hit picks the kernel
+ * for its material once: diffuse hits never test the shiny paths, and
+ * reflective hits never build a refraction ray. Deeper limits fall back to
+ * the same kernels with the depth passed at run time. Every path gives the
+ * same colour bit for bit.
+ */
+#include "scene.hpp"
+#include "shading.hpp"
+#include "stats.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <utility>
+
+namespace mini_ray {
+
+// Deepest TraceOptions::max_depth with unrolled kernels
+constexpr int MAX_UNROLLED_DEPTH{6};
+
+template <typename T>
+Vec3<T> trace(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+              const Scene<T> &scene, const int &depth,
+              const TraceOptions &options = {}, T throughput = 1);
+
+namespace trace_detail {
+
+template <typename T>
+Vec3<T> shade_diffuse(const SurfaceHit<T> &surface, const Scene<T> &scene,
+                      const TraceOptions &options) {
+    const auto &spheres{scene.spheres()};
+    Vec3<T> surface_colour{};
+
+    select_lights(surface, scene, options, [&](std::size_t i, T weight) {
+        const auto direction{light_direction(surface, spheres.centre(i))};
+
+        // Check light -> world object interactions, skipping the light
+        // itself
+        const bool occluded{
+            scene.occluded(shadow_origin(surface), direction, i)};
+
+        surface_colour += light_contribution(
+            surface, direction, spheres.material(i).emission_colour, occluded,
+            weight);
+    });
+
+    return surface_colour + surface.sphere.emission_colour;
+}
+
+// Shade a shiny surface; trace_next(orig, dir, throughput) traces a ray of
+// the next bounce
+template <bool Refracts, typename T, typename TraceNext>
+Vec3<T> shade_shiny(const Vec3<T> &ray_dir, const SurfaceHit<T> &surface,
+                    int depth, T throughput, const TraceOptions &options,
+                    TraceNext &&trace_next) {
+    auto rays{scatter_rays<Refracts>(ray_dir, surface)};
+    continue_paths(surface, rays, depth, throughput, options);
+
+    MINIRAY_COUNT(reflection, rays.reflects);
+    MINIRAY_COUNT(depth[RayStats::depth_bin(depth + 1)],
+                  rays.reflects + rays.refracts);
+    MINIRAY_COUNT(refraction, rays.refracts);
+
+    Vec3<T> reflection{}, refraction{};
+
+    if (rays.reflects) // Recursively bounce ray
+        reflection = trace_next(rays.refl_orig, rays.refl_dir,
+                                rays.refl_throughput);
+
+    if constexpr (Refracts) {
+        if (rays.refracts)
+            refraction = trace_next(rays.refr_orig, rays.refr_dir,
+                                    rays.refr_throughput);
+    }
+
+    return scattered_colour(surface, rays, reflection, refraction) +
+           surface.sphere.emission_colour;
+}
+
+// The material dispatch shared by both forms of the recursion
+template <typename T, typename TraceNext>
+Vec3<T> shade_surface(const Vec3<T> &ray_dir, const SurfaceHit<T> &surface,
+                      const Scene<T> &scene, int depth, T throughput,
+                      const TraceOptions &options, TraceNext &&trace_next) {
+    switch (material(surface.sphere)) {
+    case Material::refractive:
+        return shade_shiny<true>(ray_dir, surface, depth, throughput, options,
+                                 trace_next);
+    case Material::reflective:
+        return shade_shiny<false>(ray_dir, surface, depth, throughput,
+                                  options, trace_next);
+    case Material::diffuse:
+        break;
+    }
+
+    return shade_diffuse(surface, scene, options);
+}
+
+template <int Depth, int MaxDepth, typename T>
+Vec3<T> shade_fixed(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                    const Scene<T> &scene, const Hit<T> &hit,
+                    const TraceOptions &options, T throughput);
+
+template <int Depth, int MaxDepth, typename T>
+Vec3<T> trace_fixed(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                    const Scene<T> &scene, const TraceOptions &options,
+                    T throughput) {
+    Hit<T> hit{};
+    scene.closest_hit(ray_orig, ray_dir, hit);
+
+    return shade_fixed<Depth, MaxDepth>(ray_orig, ray_dir, scene, hit,
+                                        options, throughput);
+}
+
+// shade() with the depth and its limit fixed at compile time
+template <int Depth, int MaxDepth, typename T>
+Vec3<T> shade_fixed(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+                    const Scene<T> &scene, const Hit<T> &hit,
+                    const TraceOptions &options, T throughput) {
+    if (!hit.found())
+        return BACKGROUND_COLOUR<T>;
+
+    const auto surface{surface_hit(ray_orig, ray_dir, scene, hit)};
+
+    if constexpr (Depth >= MaxDepth) {
+        return shade_diffuse(surface, scene, options);
+    } else {
+        return shade_surface(
+            ray_dir, surface, scene, Depth, throughput, options,
+            [&](const Vec3<T> &orig, const Vec3<T> &dir, T next_throughput) {
+                return trace_fixed<Depth + 1, MaxDepth>(orig, dir, scene,
+                                                        options,
+                                                        next_throughput);
+            });
+    }
+}
+
+template <typename T>
+using ShadeKernel = Vec3<T> (*)(const Vec3<T> &, const Vec3<T> &,
+                                const Scene<T> &, const Hit<T> &,
+                                const TraceOptions &, T);
+
+constexpr int UNROLLED{MAX_UNROLLED_DEPTH + 1};
+
+// Kernel for depth limit Kernel / UNROLLED entered at depth Kernel % UNROLLED.
+// Past the limit every depth shades the same, so those share one kernel.
+template <typename T, int... Kernel>
+constexpr std::array<ShadeKernel<T>, sizeof...(Kernel)>
+shade_kernels(std::integer_sequence<int, Kernel...>) {
+    return {&shade_fixed<std::min(Kernel % UNROLLED, Kernel / UNROLLED),
+                         Kernel / UNROLLED, T>...};
+}
+
+template <typename T>
+constexpr auto SHADE_KERNELS{shade_kernels<T>(
+    std::make_integer_sequence<int, UNROLLED * UNROLLED>{})};
+
+} // namespace trace_detail
+
+// Colour seen along a ray whose closest intersection is already known. Rays
+// that missed everything see the background colour.
+template <typename T>
+Vec3<T> shade(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+              const Scene<T> &scene, const int &depth, const Hit<T> &hit,
+              const TraceOptions &options = {}, T throughput = 1) {
+    const int max_depth{options.max_depth};
+
+    if (max_depth >= 0 && max_depth <= MAX_UNROLLED_DEPTH && depth >= 0) {
+        const int entry{std::min(depth, trace_detail::UNROLLED - 1)};
+
+        return trace_detail::SHADE_KERNELS<T>[max_depth *
+                                                  trace_detail::UNROLLED +
+                                              entry](
+            ray_orig, ray_dir, scene, hit, options, throughput);
+    }
+
+    if (!hit.found())
+        return BACKGROUND_COLOUR<T>;
+
+    const auto surface{surface_hit(ray_orig, ray_dir, scene, hit)};
+
+    if (depth >= max_depth)
+        return trace_detail::shade_diffuse(surface, scene, options);
+
+    return trace_detail::shade_surface(
+        ray_dir, surface, scene, depth, throughput, options,
+        [&](const Vec3<T> &orig, const Vec3<T> &dir, T next_throughput) {
+            return trace(orig, dir, scene, depth + 1, options,
+                         next_throughput);
+        });
+}
+
+template <typename T>
+Vec3<T> trace(const Vec3<T> &ray_orig, const Vec3<T> &ray_dir,
+              const Scene<T> &scene, const int &depth,
+              const TraceOptions &options, T throughput) {
+    // Find ray -> sphere intersection
+    Hit<T> hit{};
+    scene.closest_hit(ray_orig, ray_dir, hit);
+
+    return shade(ray_orig, ray_dir, scene, depth, hit, options, throughput);
+}
+
+} // namespace mini_ray
+
+#endif
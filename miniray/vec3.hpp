@@ -0,0 +1,86 @@
+#ifndef MINIRAY_VEC3_HPP
+#define MINIRAY_VEC3_HPP
+
+#include <cmath>
+#include <limits>
+#include <ostream>
+
+const double PI{3.1415926535897932385};
+const double INF{std::numeric_limits<double>::infinity()};
+
+namespace mini_ray {
+
+template <typename T> class Vec3 {
+  public:
+    T x{}, y{}, z{};
+
+    Vec3() : x{0}, y{0}, z{0} {};
+    explicit Vec3(T x) : x{x}, y{x}, z{x} {};
+    Vec3(T x, T y, T z) : x{x}, y{y}, z{z} {};
+    // Conversion between precisions
+    template <typename U>
+    explicit Vec3(const Vec3<U> &v)
+        : x{static_cast<T>(v.x)}, y{static_cast<T>(v.y)},
+          z{static_cast<T>(v.z)} {}
+
+    // Operator overloads
+    Vec3<T> operator*(const T &f) const { return Vec3<T>{x * f, y * f, z * f}; }
+    Vec3<T> operator*(const Vec3<T> &v) const {
+        return Vec3<T>{x * v.x, y * v.y, z * v.z};
+    } // For colour scaling
+    Vec3<T> &operator*=(const Vec3<T> &v) {
+        x *= v.x;
+        y *= v.y;
+        z *= v.z;
+
+        return *this;
+    }
+
+    Vec3<T> operator+(const Vec3<T> &v) const {
+        return Vec3<T>{x + v.x, y + v.y, z + v.z};
+    }
+    Vec3<T> &operator+=(const Vec3<T> &v) {
+        x += v.x;
+        y += v.y;
+        z += v.z;
+
+        return *this;
+    }
+
+    Vec3<T> operator-() const { return Vec3<T>{-x, -y, -z}; }
+    Vec3<T> operator-(const Vec3<T> &v) const {
+        return Vec3<T>{x - v.x, y - v.y, z - v.z};
+    }
+
+    // Utility
+    T length_squared() const { return x * x + y * y + z * z; }
+    T length() const { return std::sqrt(length_squared()); }
+    T dot(const Vec3<T> &v) const { return x * v.x + y * v.y + z * v.z; }
+    Vec3<T> normalise() {
+        T normal_squared{length_squared()};
+
+        if (normal_squared > 0) {
+            T inv_normal{1 / std::sqrt(normal_squared)};
+            // *this *= inv_normal; // POT_ERR
+
+            x *= inv_normal;
+            y *= inv_normal;
+            z *= inv_normal;
+        }
+
+        return *this;
+    }
+    friend std::ostream &operator<<(std::ostream &out, const Vec3<T> &v) {
+        out << "[" << v.x << ' ' << v.y << ' ' << v.z << "]";
+        return out;
+    }
+};
+
+// Common type aliases
+template <typename T> using Point3 = Vec3<T>;
+using Vec3f = Vec3<double>;
+using Point3f = Point3<double>;
+
+} // namespace mini_ray
+
+#endif
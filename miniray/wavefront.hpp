@@ -0,0 +1,316 @@
+#ifndef MINIRAY_WAVEFRONT_HPP
+#define MINIRAY_WAVEFRONT_HPP
+
+/*
+ * Wavefront engine. Rather than recursing per pixel, a whole batch of rays is
+ * pushed through the scene one bounce at a time. Each bounce keeps explicit
+ * queues per ray kind (primary, reflection, refraction, shadow) and every
+ * queue is intersected in one pass, optionally sorted so that rays with
+ * similar directions are traced back to back.
+ *
+ * Hits are recorded as path vertices. Once the deepest bounce is done the
+ * vertices are resolved from the bottom up with the same shading steps the
+ * recursive trace() uses, so both engines produce the same image bit for bit.
+ */
+#include "scene.hpp"
+#include "shading.hpp"
+#include "stats.hpp"
+#include "vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mini_ray {
+
+enum class RayKind : std::uint8_t { primary, reflection, refraction, shadow };
+
+// A tracer keeps its queues between calls, so reusing one per thread avoids
+// reallocating them for every batch.
+template <typename T> class WavefrontTracer {
+  public:
+    explicit WavefrontTracer(const Scene<T> &scene,
+                             const TraceOptions &options = {},
+                             bool sort_queues = true)
+        : m_scene{scene}, m_options{options}, m_sort_queues{sort_queues} {
+        m_options.max_depth =
+            std::clamp(options.max_depth, 0, MAX_TRACE_DEPTH);
+        m_levels.resize(static_cast<std::size_t>(m_options.max_depth) + 1);
+    }
+
+    // Trace the primary rays (ray_origs[i], ray_dirs[i]) and write the colour
+    // each one sees to colours[i]. With MINIRAY_STATS, the work spent on ray
+    // i and all rays it spawns is added to costs[i] if costs is given.
+    void trace(const std::vector<Vec3<T>> &ray_origs,
+               const std::vector<Vec3<T>> &ray_dirs, Vec3<T> *colours,
+               std::uint64_t *costs = nullptr) {
+        m_costs = costs;
+
+        for (auto &level : m_levels) {
+            for (auto &queue : level.queues)
+                queue.clear();
+
+            level.shadows.clear();
+            level.vertices.clear();
+        }
+
+        m_level_count = 1;
+
+        auto &primary{m_levels[0].queues[queue_index(RayKind::primary)]};
+
+        for (std::size_t i = 0; i < ray_dirs.size(); ++i)
+            primary.push_back(
+                QueuedRay{ray_origs[i], ray_dirs[i],
+                          static_cast<std::uint32_t>(i),
+                          static_cast<std::uint32_t>(i), RayKind::primary,
+                          1});
+
+        for (int depth = 0; depth < m_level_count; ++depth)
+            extend(depth);
+
+        resolve(colours);
+    }
+
+  private:
+    struct QueuedRay {
+        Vec3<T> orig{}, dir{};
+        std::uint32_t target{}; // Parent vertex, or output slot for primaries
+        std::uint32_t slot{};   // Output slot of the primary ray
+        RayKind kind{};
+        T throughput{};
+    };
+
+    struct ShadowRay {
+        Vec3<T> orig{}, dir{};
+        std::uint32_t vertex{}, slot{};
+        std::size_t light{};
+        T weight{};
+        bool occluded{false};
+    };
+
+    struct PathVertex {
+        std::uint32_t target{}, slot{};
+        RayKind kind{};
+        bool hit{false};
+        bool scatters{false};
+        SurfaceHit<T> surface{};
+        ScatterRays<T> rays{};
+        Vec3<T> reflection{}, refraction{}, direct{};
+        Vec3<T> colour{};
+    };
+
+    struct Level {
+        // Primary rays at depth 0, reflection and refraction rays below
+        std::array<std::vector<QueuedRay>, 3> queues{};
+        std::vector<ShadowRay> shadows{};
+        std::vector<PathVertex> vertices{};
+    };
+
+    const Scene<T> &m_scene;
+    TraceOptions m_options;
+    bool m_sort_queues;
+    std::vector<Level> m_levels; // One per bounce, never resized
+    int m_level_count{0};
+    std::vector<Hit<T>> m_hits{};
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> m_order{};
+    std::uint64_t *m_costs{nullptr};
+
+    static std::size_t queue_index(RayKind kind) {
+        return static_cast<std::size_t>(kind);
+    }
+
+    // Intersect every queue of one bounce, turn the hits into path vertices
+    // and queue up the rays of the next bounce and the shadow rays
+    void extend(int depth) {
+        for (auto &queue : m_levels[depth].queues) {
+            m_hits.assign(queue.size(), Hit<T>{});
+
+            for_each_sorted(queue, [&](std::uint32_t i) {
+                const auto before{thread_cost()};
+                m_scene.closest_hit(queue[i].orig, queue[i].dir, m_hits[i]);
+                charge(queue[i].slot, before);
+            });
+
+            for (std::size_t i = 0; i < queue.size(); ++i)
+                add_vertex(depth, queue[i], m_hits[i]);
+        }
+
+        auto &shadows{m_levels[depth].shadows};
+
+        for_each_sorted(shadows, [&](std::uint32_t i) {
+            const auto before{thread_cost()};
+            shadows[i].occluded = m_scene.occluded(
+                shadows[i].orig, shadows[i].dir, shadows[i].light);
+            charge(shadows[i].slot, before);
+        });
+
+        // Shadow rays were queued per vertex in light order, so summing them
+        // in queue order matches the recursive engine
+        auto &vertices{m_levels[depth].vertices};
+
+        for (const auto &shadow : shadows) {
+            auto &vertex{vertices[shadow.vertex]};
+
+            vertex.direct += light_contribution(
+                vertex.surface, shadow.dir,
+                m_scene.spheres().material(shadow.light).emission_colour,
+                shadow.occluded, shadow.weight);
+        }
+    }
+
+    void add_vertex(int depth, const QueuedRay &ray, const Hit<T> &hit) {
+        auto &level{m_levels[depth]};
+        const auto vertex_index{
+            static_cast<std::uint32_t>(level.vertices.size())};
+
+        level.vertices.emplace_back();
+        auto &vertex{level.vertices.back()};
+        vertex.target = ray.target;
+        vertex.slot = ray.slot;
+        vertex.kind = ray.kind;
+        vertex.hit = hit.found();
+
+        if (!vertex.hit)
+            return;
+
+        vertex.surface = surface_hit(ray.orig, ray.dir, m_scene, hit);
+        vertex.scatters = scatters(vertex.surface.sphere, depth, m_options);
+
+        if (vertex.scatters) {
+            vertex.rays = scatter(ray.dir, vertex.surface);
+            continue_paths(vertex.surface, vertex.rays, depth, ray.throughput,
+                           m_options);
+
+            auto &next{m_levels[depth + 1]};
+            const auto &rays{vertex.rays};
+
+            MINIRAY_COUNT(reflection, rays.reflects);
+            MINIRAY_COUNT(depth[RayStats::depth_bin(depth + 1)],
+                          rays.reflects + rays.refracts);
+            MINIRAY_COUNT(refraction, rays.refracts);
+
+            if (rays.reflects || rays.refracts)
+                m_level_count = std::max(m_level_count, depth + 2);
+
+            if (rays.reflects)
+                next.queues[queue_index(RayKind::reflection)].push_back(
+                    QueuedRay{rays.refl_orig, rays.refl_dir, vertex_index,
+                              vertex.slot, RayKind::reflection,
+                              rays.refl_throughput});
+
+            if (rays.refracts)
+                next.queues[queue_index(RayKind::refraction)].push_back(
+                    QueuedRay{rays.refr_orig, rays.refr_dir, vertex_index,
+                              vertex.slot, RayKind::refraction,
+                              rays.refr_throughput});
+
+            return;
+        }
+
+        // Diffuse object: one shadow ray per selected light, queued in the
+        // order the recursive engine visits them
+        const auto &spheres{m_scene.spheres()};
+
+        select_lights(vertex.surface, m_scene, m_options,
+                      [&](std::size_t i, T weight) {
+                          level.shadows.push_back(ShadowRay{
+                              shadow_origin(vertex.surface),
+                              light_direction(vertex.surface,
+                                              spheres.centre(i)),
+                              vertex_index, vertex.slot, i, weight});
+                      });
+    }
+
+    // Add the work done since before to the primary ray in slot
+    void charge(std::uint32_t slot, std::uint64_t before) {
+        if constexpr (STATS_ENABLED) {
+            if (m_costs)
+                m_costs[slot] += thread_cost() - before;
+        }
+    }
+
+    // Combine colours from the deepest bounce upwards
+    void resolve(Vec3<T> *colours) {
+        for (auto depth = m_level_count - 1; depth >= 0; --depth) {
+            for (auto &vertex : m_levels[depth].vertices) {
+                if (!vertex.hit) {
+                    vertex.colour = BACKGROUND_COLOUR<T>;
+                } else {
+                    const Vec3<T> surface_colour{
+                        vertex.scatters
+                            ? scattered_colour(vertex.surface, vertex.rays,
+                                               vertex.reflection,
+                                               vertex.refraction)
+                            : vertex.direct};
+
+                    vertex.colour =
+                        surface_colour + vertex.surface.sphere.emission_colour;
+                }
+
+                if (depth == 0) {
+                    colours[vertex.target] = vertex.colour;
+                } else {
+                    auto &parent{m_levels[depth - 1].vertices[vertex.target]};
+
+                    if (vertex.kind == RayKind::reflection)
+                        parent.reflection = vertex.colour;
+                    else
+                        parent.refraction = vertex.colour;
+                }
+            }
+        }
+    }
+
+    // Visit a queue either in order or grouped by direction octant and then
+    // by a Morton code of the quantised direction
+    template <typename Ray, typename Visit>
+    void for_each_sorted(const std::vector<Ray> &queue, Visit &&visit) {
+        if (!m_sort_queues) {
+            for (std::size_t i = 0; i < queue.size(); ++i)
+                visit(static_cast<std::uint32_t>(i));
+
+            return;
+        }
+
+        m_order.clear();
+
+        for (std::size_t i = 0; i < queue.size(); ++i)
+            m_order.emplace_back(direction_key(queue[i].dir),
+                                 static_cast<std::uint32_t>(i));
+
+        std::sort(m_order.begin(), m_order.end());
+
+        for (const auto &entry : m_order)
+            visit(entry.second);
+    }
+
+    static std::uint32_t direction_key(const Vec3<T> &dir) {
+        // NaN fails the comparison and goes to 0; refraction can produce
+        // it, and converting it to an integer is undefined
+        const auto quantise = [](T c) {
+            const double v{(static_cast<double>(c) + 1) * 0.5 * 127};
+
+            return static_cast<std::uint32_t>(!(v >= 0) ? 0.0
+                                                        : std::min(v, 127.0));
+        };
+        const std::uint32_t q[3]{quantise(dir.x), quantise(dir.y),
+                                 quantise(dir.z)};
+        const std::uint32_t octant{(dir.x < 0 ? 1u : 0u) |
+                                   (dir.y < 0 ? 2u : 0u) |
+                                   (dir.z < 0 ? 4u : 0u)};
+        std::uint32_t code{0};
+
+        for (int bit = 6; bit >= 0; --bit) {
+            for (int axis = 0; axis < 3; ++axis)
+                code = (code << 1) | ((q[axis] >> bit) & 1u);
+        }
+
+        return octant << 21 | code;
+    }
+};
+
+} // namespace mini_ray
+
+#endif